@@ -8,10 +8,14 @@
  *
  * Description: Header file for driver Squeue.c to perform basic operation
  * of enquing and dequing data from Circular Buffer. It includes both dynamic
- * and static implementation of allocating buffers.
- * 
+ * and static implementation of allocating buffers, and a family of ring
+ * buffers specialized at compile time by DEFINE_CIRCULAR_BUFFER().
+ *
  *****************************************************************************/
- 
+
+#ifndef CIRCULAR_BUFFER_H
+#define CIRCULAR_BUFFER_H
+
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/fs.h>
@@ -19,44 +23,32 @@
 #include <linux/types.h>
 #include <linux/slab.h>
 #include <linux/device.h>
+#include <linux/mm.h>
+#include <linux/log2.h>
+#include <linux/spinlock.h>
+#include <linux/cache.h>
+#include <asm/barrier.h>
 #include <asm/uaccess.h>
+#include "Squeue_ioctl.h"
 /**
- * Maximum Queue Size
- */ 
-#define MAX_QUEUE_SIZE 10
-
-/**
- * Comment Below Line to run code as Dynamic Memory Allocate Code
- * If not commented then code runs as a Static Memory Allocated Code
- */
-#define STATIC
-
-/**
- * Message Token Structure
+ * Default Queue Size, used by the queues created at module load
  */
-typedef struct MessageToken_Tag
-{
-	int msgID;
-	int senderID;
-	int receiverID;
-	char str_msg[80];
-	unsigned long timeStamp1;
-	unsigned long timeStamp2;
-}MessageToken;
+#define MAX_QUEUE_SIZE 10
 
 /**
- * Circular Buffer Structure
+ * Circular Buffer Structure. The slot array is allocated by
+ * init_CircularBuffer() for the capacity requested for the queue. A Static
+ * buffer holds the tokens in msg, a Dynamic one allocates every token on
+ * enqueue and holds pointers to them in msgp.
  */
 typedef struct CircularBuffer_Tag
 {
-#ifdef STATIC
-	MessageToken msg[MAX_QUEUE_SIZE+1];
-#else
-	MessageToken *msg[MAX_QUEUE_SIZE];
-#endif
+	MessageToken *msg;
+	MessageToken **msgp;
 	unsigned int frontIndex;
 	unsigned int rearIndex;
 	int size;
+	int isDynamic;
 }CircularBuffer;
 
 /**
@@ -64,9 +56,12 @@ typedef struct CircularBuffer_Tag
  */
 int isCircularBuffer_Full(CircularBuffer *cb);
 int isCircularBuffer_Empty(CircularBuffer *cb);
-void init_CircularBuffer(CircularBuffer *cb);
+unsigned int count_CircularBuffer(CircularBuffer *cb);
+int init_CircularBuffer(CircularBuffer *cb, unsigned int capacity, int isDynamic);
 int enqueue_CircularBuffer(CircularBuffer *cb, MessageToken *msgtoken);
 int dequeue_CircularBuffer(CircularBuffer *cb, MessageToken *msgtoken);
+MessageToken *front_CircularBuffer(CircularBuffer *cb);
+void drop_CircularBuffer(CircularBuffer *cb);
 void clean_CircularBuffer(CircularBuffer *cb);
 void display_CircularBuffer(CircularBuffer *cb);
 
@@ -87,17 +82,54 @@ inline int isCircularBuffer_Empty(CircularBuffer *cb)
 }
 
 /**
- * Function to initialize Circular Buffer
+ * Function to get the number of tokens held in Circular Buffer. It may be
+ * called without the device lock, e.g. from sysfs, for a snapshot value.
+ */
+inline unsigned int count_CircularBuffer(CircularBuffer *cb)
+{
+	return (READ_ONCE(cb->rearIndex) + cb->size - READ_ONCE(cb->frontIndex)) % cb->size;
+}
+
+/**
+ * Function to initialize Circular Buffer to hold capacity tokens.
+ * One slot is kept free to tell a full buffer from an empty one.
  */
-void init_CircularBuffer(CircularBuffer *cb)
+int init_CircularBuffer(CircularBuffer *cb, unsigned int capacity, int isDynamic)
 {
-#ifdef STATIC
-	cb->size  = MAX_QUEUE_SIZE+1;
-#else
-	cb->size = MAX_QUEUE_SIZE;
-#endif
+	cb->size = capacity + 1;
+	cb->isDynamic = isDynamic;
+	cb->msg = NULL;
+	cb->msgp = NULL;
+	if(isDynamic)
+	{
+		cb->msgp = kvmalloc_array(cb->size, sizeof(*cb->msgp), GFP_KERNEL);
+	}
+	else
+	{
+		cb->msg = kvmalloc_array(cb->size, sizeof(*cb->msg), GFP_KERNEL);
+	}
+	if(!cb->msg && !cb->msgp)
+	{
+		return -ENOMEM;
+	}
     cb->frontIndex = 0;
     cb->rearIndex = 0;
+    return 0;
+}
+
+/**
+ * Function to free Circular Buffer along with any tokens still queued
+ */
+void clean_CircularBuffer(CircularBuffer *cb)
+{
+	while(!isCircularBuffer_Empty(cb))
+	{
+		drop_CircularBuffer(cb);
+	}
+	kvfree(cb->msg);
+	kvfree(cb->msgp);
+	cb->msg = NULL;
+	cb->msgp = NULL;
 }
 
 /**
@@ -110,21 +142,25 @@ inline int enqueue_CircularBuffer(CircularBuffer *cb, MessageToken *msgtoken)
 	{
 		return -1;
 	}
-#ifdef STATIC
-    cb->msg[cb->rearIndex] = *msgtoken;
-    retValue = cb->rearIndex;
-    cb->rearIndex = (cb->rearIndex + 1) % cb->size;
-#else
-	cb->msg[cb->rearIndex] = kmalloc(sizeof(MessageToken), GFP_KERNEL);
-	memcpy(cb->msg[cb->rearIndex],msgtoken,sizeof(MessageToken));
+	if(!cb->isDynamic)
+	{
+		cb->msg[cb->rearIndex] = *msgtoken;
+	}
+	else
+	{
+		cb->msgp[cb->rearIndex] = kmalloc(sizeof(MessageToken), GFP_KERNEL);
+		if(!cb->msgp[cb->rearIndex])
+		{
+			return -1;
+		}
+		memcpy(cb->msgp[cb->rearIndex],msgtoken,sizeof(MessageToken));
+	}
     retValue = cb->rearIndex;
     cb->rearIndex = (cb->rearIndex + 1) % cb->size;
-    
-#endif
     return retValue;
 }
 
-/** 
+/**
  * Function to Dequeue/Read/Remove data from Circular Buffer
  */
 inline int dequeue_CircularBuffer(CircularBuffer *cb, MessageToken *msgtoken)
@@ -134,15 +170,143 @@ inline int dequeue_CircularBuffer(CircularBuffer *cb, MessageToken *msgtoken)
 	{
 		return -1;
 	}
-#ifdef STATIC
-    *msgtoken = cb->msg[cb->frontIndex];
-    retValue = cb->frontIndex;
-    cb->frontIndex = (cb->frontIndex + 1) % cb->size;
-#else
-	memcpy(msgtoken,cb->msg[cb->frontIndex],sizeof(MessageToken));
+	memcpy(msgtoken,front_CircularBuffer(cb),sizeof(MessageToken));
 	retValue = cb->frontIndex;
-	kfree(cb->msg[cb->frontIndex]);
-	cb->frontIndex = (cb->frontIndex + 1) % cb->size;
-#endif
+	drop_CircularBuffer(cb);
     return retValue;
 }
+
+/**
+ * Function to get the token at the front of a non-empty Circular Buffer
+ * without removing it
+ */
+inline MessageToken *front_CircularBuffer(CircularBuffer *cb)
+{
+	if(!cb->isDynamic)
+	{
+		return &cb->msg[cb->frontIndex];
+	}
+	return cb->msgp[cb->frontIndex];
+}
+
+/**
+ * Function to remove the token at the front of a non-empty Circular Buffer
+ * without copying it out
+ */
+inline void drop_CircularBuffer(CircularBuffer *cb)
+{
+	if(cb->isDynamic)
+	{
+		kfree(cb->msgp[cb->frontIndex]);
+	}
+	cb->frontIndex = (cb->frontIndex + 1) % cb->size;
+}
+
+/**
+ * Concurrency modes of the specialized ring buffers.
+ * CB_MODE_LOCKED - producers and consumers are serialized by the caller.
+ * CB_MODE_SPSC   - one producer and one consumer run concurrently without
+ *                  locks, the indices are handed over with acquire/release.
+ * CB_MODE_MPSC   - as SPSC, but producers are serialized by a spinlock of
+ *                  the ring so that any number of them may enqueue.
+ */
+#define CB_MODE_LOCKED	0
+#define CB_MODE_SPSC	1
+#define CB_MODE_MPSC	2
+
+/**
+ * Loads/stores of an index owned by the other side of the ring. They are
+ * plain accesses in CB_MODE_LOCKED, where the caller's lock orders them.
+ */
+#define CB_ACQUIRE(mode, index) \
+	((mode) == CB_MODE_LOCKED ? (index) : smp_load_acquire(&(index)))
+#define CB_RELEASE(mode, index, value)							\
+	do															\
+	{															\
+		if((mode) == CB_MODE_LOCKED)							\
+			(index) = (value);									\
+		else													\
+			smp_store_release(&(index), (value));				\
+	} while(0)
+
+/**
+ * DEFINE_CIRCULAR_BUFFER() generates the ring buffer type "name" holding
+ * capacity elements of type in place, and its functions init_name(),
+ * count_name(), isEmpty_name(), enqueue_name(), dequeue_name(), front_name()
+ * and drop_name(). capacity must be a power of two. As capacity, the element
+ * size and the concurrency mode are constants, indices wrap with a mask and
+ * the element copies and mode checks are resolved at compile time.
+ *
+ * The indices run freely and are reduced to a slot only on access, so all
+ * capacity slots are usable. front_name() returns NULL on an empty ring.
+ * enqueue_name() and dequeue_name() return the slot used, or -1 if the ring
+ * was full or empty.
+ */
+#define DEFINE_CIRCULAR_BUFFER(name, type, capacity, mode)				\
+typedef struct name##_Tag												\
+{																		\
+	type msg[capacity];													\
+	unsigned int frontIndex ____cacheline_aligned_in_smp;	/* Consumer */	\
+	unsigned int rearIndex ____cacheline_aligned_in_smp;	/* Producer */	\
+	spinlock_t producerLock;	/* Serializes producers in MPSC mode */	\
+}name;																	\
+																		\
+static inline void init_##name(name *cb)								\
+{																		\
+	BUILD_BUG_ON_NOT_POWER_OF_2(capacity);								\
+	cb->frontIndex = 0;													\
+	cb->rearIndex = 0;													\
+	spin_lock_init(&cb->producerLock);									\
+}																		\
+																		\
+static inline unsigned int count_##name(name *cb)						\
+{																		\
+	return READ_ONCE(cb->rearIndex) - READ_ONCE(cb->frontIndex);		\
+}																		\
+																		\
+static inline int isEmpty_##name(name *cb)								\
+{																		\
+	return CB_ACQUIRE(mode, cb->rearIndex) == cb->frontIndex;			\
+}																		\
+																		\
+static inline int enqueue_##name(name *cb, const type *item)			\
+{																		\
+	unsigned int rear;													\
+	int retValue = -1;													\
+	if((mode) == CB_MODE_MPSC)											\
+		spin_lock(&cb->producerLock);									\
+	rear = cb->rearIndex;												\
+	if(rear - CB_ACQUIRE(mode, cb->frontIndex) < (capacity))			\
+	{																	\
+		retValue = rear & ((capacity) - 1);								\
+		memcpy(&cb->msg[retValue], item, sizeof(type));					\
+		CB_RELEASE(mode, cb->rearIndex, rear + 1);						\
+	}																	\
+	if((mode) == CB_MODE_MPSC)											\
+		spin_unlock(&cb->producerLock);									\
+	return retValue;													\
+}																		\
+																		\
+static inline type *front_##name(name *cb)								\
+{																		\
+	if(isEmpty_##name(cb))												\
+		return NULL;													\
+	return &cb->msg[cb->frontIndex & ((capacity) - 1)];					\
+}																		\
+																		\
+static inline void drop_##name(name *cb)								\
+{																		\
+	CB_RELEASE(mode, cb->frontIndex, cb->frontIndex + 1);				\
+}																		\
+																		\
+static inline int dequeue_##name(name *cb, type *item)					\
+{																		\
+	unsigned int front = cb->frontIndex;								\
+	if(CB_ACQUIRE(mode, cb->rearIndex) == front)						\
+		return -1;														\
+	memcpy(item, &cb->msg[front & ((capacity) - 1)], sizeof(type));		\
+	CB_RELEASE(mode, cb->frontIndex, front + 1);						\
+	return front & ((capacity) - 1);									\
+}
+
+#endif /* CIRCULAR_BUFFER_H */
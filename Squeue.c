@@ -17,8 +17,22 @@
 #include <linux/semaphore.h>
 #include <asm/uaccess.h>
 #include <linux/jiffies.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/idr.h>
+#include <linux/mutex.h>
+#include <linux/filter.h>
+#include <linux/uio.h>
+#include <linux/splice.h>
+#include <linux/hashtable.h>
+#include <linux/math64.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <asm/tsc.h>
 #include "CircularBuffer.h"
+#include "Squeue_ioctl.h"
 #include <linux/init.h>
+#include <linux/version.h>
 
 #define DEVICE_DRIVER_NAME "SMQDriver"
 #define DEVICE_NAME1 "bus_in_q"
@@ -26,143 +40,1715 @@
 #define DEVICE_NAME3 "bus_out_q2"
 #define DEVICE_NAME4 "bus_out_q3"
 
+/**
+ * Number of minors reserved for the driver. Minor 0 is the control node,
+ * the queues are given the remaining ones as they are created.
+ */
+#define SQUEUE_MAX_DEVICES 1024
+
+/**
+ * Create bus_in_q as a fair queue, see SQUEUE_RING_FAIR
+ */
+static bool fair_bus_in_q;
+module_param(fair_bus_in_q, bool, 0444);
+MODULE_PARM_DESC(fair_bus_in_q, "Schedule bus_in_q per senderID by deficit round robin");
+
+/**
+ * per device statistics, kept per-cpu so that the hot path never shares a
+ * cache line with another cpu. Field names double as the sysfs file names.
+ */
+struct Queue_stats
+{
+	u64 enqueues;                   /* Tokens written to the queue */
+	u64 dequeues;                   /* Tokens read from the queue */
+	u64 full_rejects;               /* Writes refused as queue was full */
+	u64 empty_rejects;              /* Reads refused as queue was empty */
+	u64 filtered;                   /* Tokens dropped by reader filters */
+	u64 expired;                    /* Tokens dropped as older than the TTL */
+	u64 bytes_copied;               /* Bytes copied from/to user space */
+	u64 lock_contended;             /* Times the device lock was busy */
+	u64 lock_wait_ns;               /* Time spent waiting for the lock */
+};
+
+/**
+ * Ring buffers specialized at compile time, X(name, capacity, mode).
+ * A queue created with one of these capacities and a matching mode uses the
+ * specialized ring; any other locked queue uses the runtime sized
+ * CircularBuffer.
+ */
+#define SQUEUE_FIXED_RINGS(X)					\
+	X(Ring16,        16,   CB_MODE_LOCKED)		\
+	X(Ring64,        64,   CB_MODE_LOCKED)		\
+	X(Ring256,       256,  CB_MODE_LOCKED)		\
+	X(Ring1024,      1024, CB_MODE_LOCKED)		\
+	X(Ring64_MPSC,   64,   CB_MODE_MPSC)		\
+	X(Ring1024_MPSC, 1024, CB_MODE_MPSC)		\
+	X(Ring64_SPSC,   64,   CB_MODE_SPSC)		\
+	X(Ring1024_SPSC, 1024, CB_MODE_SPSC)
+
+#define X(name, capacity, mode) DEFINE_CIRCULAR_BUFFER(name, MessageToken, capacity, mode)
+SQUEUE_FIXED_RINGS(X)
+#undef X
+
+/**
+ * Fair queueing ring, SQUEUE_RING_FAIR. Every sender gets its own sub-queue
+ * on its first token, and readers take tokens from the backlogged senders by
+ * deficit round robin: on its turn a sender hands out up to weight tokens,
+ * then goes to the back of the round. The sub-queues share the queue's
+ * capacity with a dynamic threshold: a sender may hold as many tokens as are
+ * still free, so a sender flooding the queue stops at about half of it and
+ * the others always find room. A token of any other sender waits for at most
+ * one round. A sub-queue starts small and doubles as its sender needs, and
+ * is freed once empty unless its sender has a weight set. All operations run
+ * under the device lock, so the ring is only used in CB_MODE_LOCKED.
+ */
+#define SQUEUE_FAIR_HASH_BITS 6
+#define SQUEUE_FAIR_INITIAL_DEPTH 8
+
+struct My_sender
+{
+	struct hlist_node hashNode;     /* In My_fair.senders */
+	struct list_head activeNode;    /* In My_fair.activeList while backlogged */
+	int senderID;
+	unsigned int weight;            /* Tokens per turn */
+	unsigned int deficit;           /* Tokens left in the current turn */
+	CircularBuffer cb;              /* Sub-queue */
+	u64 *enqueueNs;                 /* Enqueue time of the token in each slot of cb */
+	u64 dequeues;                   /* Tokens removed from the sub-queue */
+	u64 latencyNs;                  /* Their total time in the sub-queue */
+	u64 maxLatencyNs;               /* Longest time in the sub-queue */
+};
+
+typedef struct My_fair_Tag
+{
+	DECLARE_HASHTABLE(senders, SQUEUE_FAIR_HASH_BITS);
+	struct list_head activeList;    /* Backlogged senders, head is serving */
+	unsigned int capacity;          /* Tokens in all sub-queues */
+	int isDynamic;                  /* Storage of the sub-queues */
+	unsigned int senderCount;
+	unsigned int count;             /* Tokens in all sub-queues */
+}My_fair;
+
+static void init_My_fair(My_fair *fair, unsigned int capacity, int isDynamic)
+{
+	hash_init(fair->senders);
+	INIT_LIST_HEAD(&fair->activeList);
+	fair->capacity = capacity;
+	fair->isDynamic = isDynamic;
+	fair->senderCount = 0;
+	fair->count = 0;
+}
+
+/**
+ * My_fair_sender() looks up a sender, creating it with weight 1 on first
+ * use. Returns NULL if it cannot be created.
+ */
+static struct My_sender *My_fair_sender(My_fair *fair, int senderID)
+{
+	struct My_sender *sender;
+	unsigned int depth;
+	hash_for_each_possible(fair->senders, sender, hashNode, senderID)
+	{
+		if(sender->senderID == senderID)
+		{
+			return sender;
+		}
+	}
+	if(fair->senderCount >= SQUEUE_FAIR_MAX_SENDERS)
+	{
+		return NULL;
+	}
+	sender = kzalloc(sizeof(struct My_sender), GFP_KERNEL);
+	if(!sender)
+	{
+		return NULL;
+	}
+	depth = min_t(unsigned int, fair->capacity, SQUEUE_FAIR_INITIAL_DEPTH);
+	sender->enqueueNs = kvmalloc_array(depth + 1, sizeof(u64), GFP_KERNEL);
+	if(!sender->enqueueNs || init_CircularBuffer(&sender->cb, depth, fair->isDynamic))
+	{
+		kvfree(sender->enqueueNs);
+		kfree(sender);
+		return NULL;
+	}
+	sender->senderID = senderID;
+	sender->weight = 1;
+	INIT_LIST_HEAD(&sender->activeNode);
+	hash_add(fair->senders, &sender->hashNode, senderID);
+	fair->senderCount++;
+	return sender;
+}
+
+/**
+ * My_fair_release() frees a sender whose sub-queue is empty, unless it has a
+ * weight set, so that only backlogged or weighted senders count against
+ * SQUEUE_FAIR_MAX_SENDERS. Returns 1 if the sender was freed.
+ */
+static int My_fair_release(My_fair *fair, struct My_sender *sender)
+{
+	if(!isCircularBuffer_Empty(&sender->cb) || sender->weight != 1)
+	{
+		return 0;
+	}
+	hash_del(&sender->hashNode);
+	clean_CircularBuffer(&sender->cb);
+	kvfree(sender->enqueueNs);
+	kfree(sender);
+	fair->senderCount--;
+	return 1;
+}
+
+/**
+ * My_fair_grow() doubles the sub-queue of a sender, up to the capacity of
+ * the queue. The queued tokens keep their order and enqueue times.
+ */
+static int My_fair_grow(My_fair *fair, struct My_sender *sender)
+{
+	unsigned int depth = count_CircularBuffer(&sender->cb);
+	unsigned int capacity = min(2 * depth, fair->capacity);
+	unsigned int i, slot;
+	CircularBuffer cb;
+	u64 *enqueueNs;
+	if(capacity <= depth)
+	{
+		return -ENOSPC;
+	}
+	enqueueNs = kvmalloc_array(capacity + 1, sizeof(u64), GFP_KERNEL);
+	if(!enqueueNs || init_CircularBuffer(&cb, capacity, fair->isDynamic))
+	{
+		kvfree(enqueueNs);
+		return -ENOMEM;
+	}
+	for(i = 0; i < depth; i++)
+	{
+		slot = (sender->cb.frontIndex + i) % sender->cb.size;
+		if(fair->isDynamic)
+		{
+			cb.msgp[i] = sender->cb.msgp[slot];
+		}
+		else
+		{
+			cb.msg[i] = sender->cb.msg[slot];
+		}
+		enqueueNs[i] = sender->enqueueNs[slot];
+	}
+	cb.rearIndex = depth;
+	/* The tokens moved, the old buffer must not free them */
+	sender->cb.frontIndex = sender->cb.rearIndex;
+	clean_CircularBuffer(&sender->cb);
+	kvfree(sender->enqueueNs);
+	sender->cb = cb;
+	sender->enqueueNs = enqueueNs;
+	return 0;
+}
+
+static int My_fair_set_weight(My_fair *fair, int senderID, unsigned int weight)
+{
+	struct My_sender *sender = My_fair_sender(fair, senderID);
+	if(!sender)
+	{
+		return -ENOSPC;
+	}
+	sender->weight = weight;
+	sender->deficit = min(sender->deficit, weight);
+	My_fair_release(fair, sender);
+	return 0;
+}
+
+static inline unsigned int count_My_fair(My_fair *fair)
+{
+	return READ_ONCE(fair->count);
+}
+
+static int enqueue_My_fair(My_fair *fair, MessageToken *msgtok)
+{
+	struct My_sender *sender;
+	int slot;
+	if(fair->count >= fair->capacity)
+	{
+		return -1;
+	}
+	sender = My_fair_sender(fair, msgtok->senderID);
+	if(!sender)
+	{
+		return -1;
+	}
+	/* Dynamic threshold, a sender may hold as many tokens as are still free */
+	if(count_CircularBuffer(&sender->cb) >= fair->capacity - fair->count ||
+		(isCircularBuffer_Full(&sender->cb) && My_fair_grow(fair, sender)))
+	{
+		My_fair_release(fair, sender);
+		return -1;
+	}
+	slot = enqueue_CircularBuffer(&sender->cb, msgtok);
+	if(slot == -1)
+	{
+		My_fair_release(fair, sender);
+		return -1;
+	}
+	sender->enqueueNs[slot] = ktime_get_ns();
+	if(list_empty(&sender->activeNode))
+	{
+		list_add_tail(&sender->activeNode, &fair->activeList);
+	}
+	WRITE_ONCE(fair->count, fair->count + 1);
+	return slot;
+}
+
+/* The front token is the next one of the sender whose turn it is */
+static MessageToken *front_My_fair(My_fair *fair)
+{
+	struct My_sender *sender;
+	sender = list_first_entry_or_null(&fair->activeList, struct My_sender, activeNode);
+	if(!sender)
+	{
+		return NULL;
+	}
+	if(!sender->deficit)
+	{
+		sender->deficit = sender->weight;       /* Start of its turn */
+	}
+	return front_CircularBuffer(&sender->cb);
+}
+
+static void drop_My_fair(My_fair *fair)
+{
+	struct My_sender *sender;
+	u64 latency;
+	front_My_fair(fair);
+	sender = list_first_entry(&fair->activeList, struct My_sender, activeNode);
+	latency = ktime_get_ns() - sender->enqueueNs[sender->cb.frontIndex];
+	sender->dequeues++;
+	sender->latencyNs += latency;
+	sender->maxLatencyNs = max(sender->maxLatencyNs, latency);
+	drop_CircularBuffer(&sender->cb);
+	WRITE_ONCE(fair->count, fair->count - 1);
+	sender->deficit--;
+	if(isCircularBuffer_Empty(&sender->cb))
+	{
+		/* An idle sender does not keep credit for later */
+		sender->deficit = 0;
+		list_del_init(&sender->activeNode);
+		My_fair_release(fair, sender);
+	}
+	else if(!sender->deficit)
+	{
+		list_move_tail(&sender->activeNode, &fair->activeList);
+	}
+}
+
+/*
+ * Drops the front token of a backlogged sender without serving it. Returns
+ * 1 once the sub-queue is empty; the sender may then have been freed.
+ */
+static int expire_My_fair(My_fair *fair, struct My_sender *sender)
+{
+	drop_CircularBuffer(&sender->cb);
+	WRITE_ONCE(fair->count, fair->count - 1);
+	if(!isCircularBuffer_Empty(&sender->cb))
+	{
+		return 0;
+	}
+	sender->deficit = 0;
+	list_del_init(&sender->activeNode);
+	My_fair_release(fair, sender);
+	return 1;
+}
+
+static int dequeue_My_fair(My_fair *fair, MessageToken *msgtok)
+{
+	MessageToken *front = front_My_fair(fair);
+	struct My_sender *sender;
+	int slot;
+	if(!front)
+	{
+		return -1;
+	}
+	sender = list_first_entry(&fair->activeList, struct My_sender, activeNode);
+	slot = sender->cb.frontIndex;
+	memcpy(msgtok, front, sizeof(MessageToken));
+	drop_My_fair(fair);
+	return slot;
+}
+
+static void clean_My_fair(My_fair *fair)
+{
+	struct My_sender *sender;
+	struct hlist_node *tmp;
+	int bkt;
+	hash_for_each_safe(fair->senders, bkt, tmp, sender, hashNode)
+	{
+		hash_del(&sender->hashNode);
+		clean_CircularBuffer(&sender->cb);
+		kvfree(sender->enqueueNs);
+		kfree(sender);
+	}
+}
+
+/**
+ * Ring variant of a queue
+ */
+enum My_ring_variant
+{
+	RING_CircularBuffer,
+	RING_My_fair,
+#define X(name, capacity, mode) RING_##name,
+	SQUEUE_FIXED_RINGS(X)
+#undef X
+};
+
 /**
  * per device structure
  */
-struct My_dev
+struct My_dev
+{
+	int minor;                      /* Minor number, index in My_dev_idr */
+	unsigned int openCount;         /* Open files, under My_dev_table_lock */
+	unsigned int readers;           /* Files open for reading, under My_dev_table_lock */
+	unsigned int writers;           /* Files open for writing, under My_dev_table_lock */
+	bool filtered;                  /* The reader has a filter, under My_dev_table_lock */
+	char name[SQUEUE_NAME_LEN];     /* Name of device*/
+	enum My_ring_variant variant;	/* Type of ring */
+	int ringMode;                   /* CB_MODE_* of ring */
+	void *ring;                     /* Circular Buffer of type variant */
+	struct semaphore mutex;		    /* SEMAPHORE per device, held by readers and locked mode writers */
+	struct Queue_stats __percpu *stats;	/* Per-cpu counters */
+	unsigned int peakOccupancy;     /* Highest occupancy seen */
+	u64 ttlNs;                      /* Time to live of tokens, 0 for none */
+	u64 ttlCycles;                  /* ttlNs in TSC cycles */
+	struct My_seq *seq;             /* Token numbering, NULL if not numbered */
+	struct dentry *debugfs;         /* debugfs directory, fair queues only */
+	struct kernfs_node *expiredDirent;	/* stats/expired, for sysfs_notify_dirent() */
+};
+
+/**
+ * My_ring_*() dispatch a ring operation to the variant of the queue. Each
+ * case is the inlined specialized function, so the only runtime cost over a
+ * single ring type is the switch.
+ */
+static inline int My_ring_enqueue(struct My_dev *my_devp, MessageToken *msgtok)
+{
+	switch(my_devp->variant)
+	{
+#define X(name, capacity, mode) case RING_##name: return enqueue_##name(my_devp->ring, msgtok);
+	SQUEUE_FIXED_RINGS(X)
+#undef X
+	case RING_My_fair:
+		return enqueue_My_fair(my_devp->ring, msgtok);
+	default:
+		return enqueue_CircularBuffer(my_devp->ring, msgtok);
+	}
+}
+
+static inline int My_ring_dequeue(struct My_dev *my_devp, MessageToken *msgtok)
+{
+	switch(my_devp->variant)
+	{
+#define X(name, capacity, mode) case RING_##name: return dequeue_##name(my_devp->ring, msgtok);
+	SQUEUE_FIXED_RINGS(X)
+#undef X
+	case RING_My_fair:
+		return dequeue_My_fair(my_devp->ring, msgtok);
+	default:
+		return dequeue_CircularBuffer(my_devp->ring, msgtok);
+	}
+}
+
+/* Returns the front token, or NULL if the queue is empty */
+static inline MessageToken *My_ring_front(struct My_dev *my_devp)
+{
+	switch(my_devp->variant)
+	{
+#define X(name, capacity, mode) case RING_##name: return front_##name(my_devp->ring);
+	SQUEUE_FIXED_RINGS(X)
+#undef X
+	case RING_My_fair:
+		return front_My_fair(my_devp->ring);
+	default:
+		if(isCircularBuffer_Empty(my_devp->ring))
+		{
+			return NULL;
+		}
+		return front_CircularBuffer(my_devp->ring);
+	}
+}
+
+/* Removes the front token of a non-empty queue */
+static inline void My_ring_drop(struct My_dev *my_devp)
+{
+	switch(my_devp->variant)
+	{
+#define X(name, capacity, mode) case RING_##name: drop_##name(my_devp->ring); return;
+	SQUEUE_FIXED_RINGS(X)
+#undef X
+	case RING_My_fair:
+		drop_My_fair(my_devp->ring);
+		return;
+	default:
+		drop_CircularBuffer(my_devp->ring);
+	}
+}
+
+static inline unsigned int My_ring_count(struct My_dev *my_devp)
+{
+	switch(my_devp->variant)
+	{
+#define X(name, capacity, mode) case RING_##name: return count_##name(my_devp->ring);
+	SQUEUE_FIXED_RINGS(X)
+#undef X
+	case RING_My_fair:
+		return count_My_fair(my_devp->ring);
+	default:
+		return count_CircularBuffer(my_devp->ring);
+	}
+}
+
+static const char *My_ring_name(struct My_dev *my_devp)
+{
+	switch(my_devp->variant)
+	{
+#define X(name, capacity, mode) case RING_##name: return #name;
+	SQUEUE_FIXED_RINGS(X)
+#undef X
+	case RING_My_fair:
+		return ((My_fair *)my_devp->ring)->isDynamic ? "Fair_Dynamic" : "Fair";
+	default:
+		return ((CircularBuffer *)my_devp->ring)->isDynamic ? "CircularBuffer_Dynamic" : "CircularBuffer";
+	}
+}
+
+/**
+ * My_ring_alloc() allocates the ring of a queue for capacity and the
+ * SQUEUE_RING_* flags, preferring a specialized variant.
+ */
+static int My_ring_alloc(struct My_dev *my_devp, unsigned int capacity, unsigned int flags)
+{
+	CircularBuffer *cb;
+	int mode = CB_MODE_LOCKED;
+	int ret;
+
+	if((flags & SQUEUE_RING_MPSC) && (flags & SQUEUE_RING_SPSC))
+	{
+		return -EINVAL;
+	}
+	if(flags & SQUEUE_RING_MPSC)
+	{
+		mode = CB_MODE_MPSC;
+	}
+	else if(flags & SQUEUE_RING_SPSC)
+	{
+		mode = CB_MODE_SPSC;
+	}
+	my_devp->ringMode = mode;
+
+	if(flags & SQUEUE_RING_FAIR)
+	{
+		My_fair *fair;
+		if(mode != CB_MODE_LOCKED)
+		{
+			return -EINVAL;
+		}
+		fair = kmalloc(sizeof(My_fair), GFP_KERNEL);
+		if(!fair)
+		{
+			return -ENOMEM;
+		}
+		init_My_fair(fair, capacity, flags & SQUEUE_RING_DYNAMIC);
+		my_devp->ring = fair;
+		my_devp->variant = RING_My_fair;
+		return 0;
+	}
+
+	if(!(flags & SQUEUE_RING_DYNAMIC))
+	{
+#define X(name, cap, m)									\
+		if(capacity == (cap) && mode == (m))			\
+		{												\
+			name *ring = kvmalloc(sizeof(name), GFP_KERNEL);	\
+			if(!ring)									\
+			{											\
+				return -ENOMEM;							\
+			}											\
+			init_##name(ring);							\
+			my_devp->ring = ring;						\
+			my_devp->variant = RING_##name;				\
+			return 0;									\
+		}
+		SQUEUE_FIXED_RINGS(X)
+#undef X
+	}
+
+	/* The runtime sized ring relies on the device lock on both sides */
+	if(mode != CB_MODE_LOCKED)
+	{
+		return -EINVAL;
+	}
+	cb = kmalloc(sizeof(CircularBuffer), GFP_KERNEL);
+	if(!cb)
+	{
+		return -ENOMEM;
+	}
+	ret = init_CircularBuffer(cb, capacity, flags & SQUEUE_RING_DYNAMIC);
+	if(ret)
+	{
+		kfree(cb);
+		return ret;
+	}
+	my_devp->ring = cb;
+	my_devp->variant = RING_CircularBuffer;
+	return 0;
+}
+
+/**
+ * My_ring_free() frees the ring of a queue along with any queued tokens.
+ */
+static void My_ring_free(struct My_dev *my_devp)
+{
+	if(my_devp->variant == RING_CircularBuffer)
+	{
+		clean_CircularBuffer(my_devp->ring);
+		kfree(my_devp->ring);
+	}
+	else if(my_devp->variant == RING_My_fair)
+	{
+		clean_My_fair(my_devp->ring);
+		kfree(my_devp->ring);
+	}
+	else
+	{
+		kvfree(my_devp->ring);
+	}
+	my_devp->ring = NULL;
+}
+
+/**
+ * Sequence numbering of a SQUEUE_RING_SEQUENCE queue. Every token is given
+ * the next msgID of the queue and the next flowSeq of its (senderID,
+ * receiverID) flow as it is enqueued. Both are taken under the device lock
+ * and only advanced once the token is in the ring, so a refused write
+ * leaves no gap and a receiver can tell lost tokens from missing numbers.
+ */
+#define SQUEUE_SEQ_HASH_BITS 8
+
+struct My_flow
+{
+	struct hlist_node hashNode;     /* In My_seq.flows */
+	int senderID;
+	int receiverID;
+	unsigned int nextSeq;           /* flowSeq of the next token */
+};
+
+struct My_seq
+{
+	DECLARE_HASHTABLE(flows, SQUEUE_SEQ_HASH_BITS);
+	unsigned int nextMsgID;         /* msgID of the next token */
+	unsigned int flowCount;
+};
+
+static struct My_seq *My_seq_alloc(void)
+{
+	struct My_seq *seq = kmalloc(sizeof(struct My_seq), GFP_KERNEL);
+	if(seq)
+	{
+		hash_init(seq->flows);
+		seq->nextMsgID = 1;
+		seq->flowCount = 0;
+	}
+	return seq;
+}
+
+static void My_seq_free(struct My_seq *seq)
+{
+	struct My_flow *flow;
+	struct hlist_node *tmp;
+	int bkt;
+	if(!seq)
+	{
+		return;
+	}
+	hash_for_each_safe(seq->flows, bkt, tmp, flow, hashNode)
+	{
+		hash_del(&flow->hashNode);
+		kfree(flow);
+	}
+	kfree(seq);
+}
+
+/**
+ * My_seq_number() numbers a token about to be enqueued and returns its flow,
+ * or NULL if the flow can not be tracked. Called with the device lock held.
+ */
+static struct My_flow *My_seq_number(struct My_seq *seq, MessageToken *msgtok)
+{
+	struct My_flow *flow;
+	u64 key = ((u64)(u32)msgtok->senderID << 32) | (u32)msgtok->receiverID;
+	hash_for_each_possible(seq->flows, flow, hashNode, key)
+	{
+		if(flow->senderID == msgtok->senderID && flow->receiverID == msgtok->receiverID)
+		{
+			goto found;
+		}
+	}
+	if(seq->flowCount >= SQUEUE_SEQ_MAX_FLOWS)
+	{
+		return NULL;
+	}
+	flow = kmalloc(sizeof(struct My_flow), GFP_KERNEL);
+	if(!flow)
+	{
+		return NULL;
+	}
+	flow->senderID = msgtok->senderID;
+	flow->receiverID = msgtok->receiverID;
+	flow->nextSeq = 1;
+	hash_add(seq->flows, &flow->hashNode, key);
+	seq->flowCount++;
+found:
+	msgtok->msgID = seq->nextMsgID;
+	msgtok->flowSeq = flow->nextSeq;
+	return flow;
+}
+
+/* Consumes the numbers given by My_seq_number() once the token is queued */
+static inline void My_seq_commit(struct My_seq *seq, struct My_flow *flow)
+{
+	seq->nextMsgID++;
+	flow->nextSeq++;
+}
+
+/**
+ * per open file structure
+ */
+struct My_file
+{
+	struct My_dev *my_devp;         /* Queue the file was opened on */
+	struct bpf_prog *filter;        /* Reader filter, under my_devp->mutex */
+};
+
+#define CREATE_TRACE_POINTS
+#include "Squeue_trace.h"
+
+static dev_t my_dev_number;      /* Allotted device number */
+struct class *my_dev_class;      /* Tie with the device model */
+static struct cdev my_ctl_cdev;  /* cdev of the control node, minor 0 */
+static struct cdev my_queue_cdev;	/* cdev shared by all queues */
+
+/**
+ * Table of the queues indexed by minor number. Create, delete, open and
+ * release are serialized by My_dev_table_lock; read and write never take it.
+ */
+static DEFINE_IDR(My_dev_idr);
+static DEFINE_MUTEX(My_dev_table_lock);
+static struct dentry *my_debugfs_root;	/* /sys/kernel/debug/SMQDriver */
+
+
+/**
+ * My_driver_lock() takes the device semaphore and accounts the time spent
+ * waiting for it. The uncontended case costs a single down_trylock().
+ * msgtok is the token about to be enqueued, or NULL on the read side.
+ */
+static void My_driver_lock(struct My_dev *my_devp, const MessageToken *msgtok)
+{
+	u64 wait;
+	if(!down_trylock(&(my_devp->mutex)))
+	{
+		return;
+	}
+	wait = ktime_get_ns();
+	down(&(my_devp->mutex));
+	wait = ktime_get_ns() - wait;
+	this_cpu_inc(my_devp->stats->lock_contended);
+	this_cpu_add(my_devp->stats->lock_wait_ns, wait);
+	trace_squeue_lock_contended(my_devp, msgtok, wait);
+}
+
+/**
+ * My_driver_open() method is used by driver to initialize.
+ */
+int My_driver_open(struct inode *inode, struct file *file)
+{
+	struct My_dev *my_devp;
+	struct My_file *my_filep;
+	my_filep = kzalloc(sizeof(struct My_file), GFP_KERNEL);
+	if(!my_filep)
+	{
+		return -ENOMEM;
+	}
+	mutex_lock(&My_dev_table_lock);
+	my_devp = idr_find(&My_dev_idr, iminor(inode));						/* Get the per-device structure of this minor */
+	if(!my_devp)
+	{
+		mutex_unlock(&My_dev_table_lock);
+		kfree(my_filep);
+		return -ENODEV;
+	}
+	if(file->f_mode & FMODE_READ)
+	{
+		/* A reader filter drops tokens from the queue every reader shares */
+		if(my_devp->filtered)
+		{
+			mutex_unlock(&My_dev_table_lock);
+			kfree(my_filep);
+			return -EBUSY;
+		}
+		my_devp->readers++;
+	}
+	if(file->f_mode & FMODE_WRITE)
+	{
+		/* Readers always take the device lock, but SPSC writers do not */
+		if(my_devp->ringMode == CB_MODE_SPSC && my_devp->writers)
+		{
+			if(file->f_mode & FMODE_READ)
+			{
+				my_devp->readers--;
+			}
+			mutex_unlock(&My_dev_table_lock);
+			kfree(my_filep);
+			return -EBUSY;
+		}
+		my_devp->writers++;
+	}
+	my_devp->openCount++;
+	mutex_unlock(&My_dev_table_lock);
+	my_filep->my_devp = my_devp;
+	file->private_data = my_filep;										/* Easy access to cmos_devp from rest of the entry points */
+	//printk("%s has opened\n", my_devp->name);
+	return 0;
+}
+
+/**
+ * My_driver_release() method is used by the driver to 
+ * close anything which has been opened and used during driver execution.
+ */
+int My_driver_release(struct inode *inode, struct file *file)
+{
+	struct My_file *my_filep = file->private_data;
+	struct My_dev *my_devp = my_filep->my_devp;
+	printk("\nMy_driver_release squeue() -- %s is closing\n", my_devp->name);
+	if(my_filep->filter)
+	{
+		bpf_prog_destroy(my_filep->filter);
+	}
+	mutex_lock(&My_dev_table_lock);
+	if(file->f_mode & FMODE_READ)
+	{
+		my_devp->readers--;
+	}
+	if(file->f_mode & FMODE_WRITE)
+	{
+		my_devp->writers--;
+	}
+	if(my_filep->filter)
+	{
+		my_devp->filtered = false;
+	}
+	kfree(my_filep);
+	my_devp->openCount--;
+	mutex_unlock(&My_dev_table_lock);
+	return 0;
+}
+
+/**
+ * My_filter_check() restricts a reader filter to loads from the MessageToken
+ * header and rewrites them to context loads, the way seccomp does for
+ * struct seccomp_data. Called by the BPF core after its own checks.
+ */
+static int My_filter_check(struct sock_filter *filter, unsigned int flen)
+{
+	unsigned int pc;
+	for(pc = 0; pc < flen; pc++)
+	{
+		struct sock_filter *ftest = &filter[pc];
+		switch(ftest->code)
+		{
+		case BPF_LD | BPF_W | BPF_ABS:
+			if(ftest->k >= SQUEUE_FILTER_LEN || ftest->k & 3)
+			{
+				return -EINVAL;
+			}
+			ftest->code = BPF_LDX | BPF_W | BPF_ABS;
+			continue;
+		case BPF_LD | BPF_W | BPF_LEN:
+			ftest->code = BPF_LD | BPF_IMM;
+			ftest->k = SQUEUE_FILTER_LEN;
+			continue;
+		case BPF_LDX | BPF_W | BPF_LEN:
+			ftest->code = BPF_LDX | BPF_IMM;
+			ftest->k = SQUEUE_FILTER_LEN;
+			continue;
+		case BPF_RET | BPF_K:
+		case BPF_RET | BPF_A:
+		case BPF_ALU | BPF_ADD | BPF_K:
+		case BPF_ALU | BPF_ADD | BPF_X:
+		case BPF_ALU | BPF_SUB | BPF_K:
+		case BPF_ALU | BPF_SUB | BPF_X:
+		case BPF_ALU | BPF_MUL | BPF_K:
+		case BPF_ALU | BPF_MUL | BPF_X:
+		case BPF_ALU | BPF_DIV | BPF_K:
+		case BPF_ALU | BPF_DIV | BPF_X:
+		case BPF_ALU | BPF_AND | BPF_K:
+		case BPF_ALU | BPF_AND | BPF_X:
+		case BPF_ALU | BPF_OR | BPF_K:
+		case BPF_ALU | BPF_OR | BPF_X:
+		case BPF_ALU | BPF_XOR | BPF_K:
+		case BPF_ALU | BPF_XOR | BPF_X:
+		case BPF_ALU | BPF_LSH | BPF_K:
+		case BPF_ALU | BPF_LSH | BPF_X:
+		case BPF_ALU | BPF_RSH | BPF_K:
+		case BPF_ALU | BPF_RSH | BPF_X:
+		case BPF_ALU | BPF_NEG:
+		case BPF_LD | BPF_IMM:
+		case BPF_LDX | BPF_IMM:
+		case BPF_MISC | BPF_TAX:
+		case BPF_MISC | BPF_TXA:
+		case BPF_LD | BPF_MEM:
+		case BPF_LDX | BPF_MEM:
+		case BPF_ST:
+		case BPF_STX:
+		case BPF_JMP | BPF_JA:
+		case BPF_JMP | BPF_JEQ | BPF_K:
+		case BPF_JMP | BPF_JEQ | BPF_X:
+		case BPF_JMP | BPF_JGE | BPF_K:
+		case BPF_JMP | BPF_JGE | BPF_X:
+		case BPF_JMP | BPF_JGT | BPF_K:
+		case BPF_JMP | BPF_JGT | BPF_X:
+		case BPF_JMP | BPF_JSET | BPF_K:
+		case BPF_JMP | BPF_JSET | BPF_X:
+			continue;
+		default:
+			return -EINVAL;
+		}
+	}
+	return 0;
+}
+
+/**
+ * My_driver_set_weight() sets the weight of a sender of a fair queue.
+ */
+static long My_driver_set_weight(struct My_dev *my_devp, unsigned long arg)
+{
+	SqueueWeightReq req;
+	int ret;
+	if(copy_from_user(&req, (void __user *)arg, sizeof(req)))
+	{
+		return -EFAULT;
+	}
+	if(my_devp->variant != RING_My_fair || req.weight == 0 || req.weight > SQUEUE_FAIR_MAX_WEIGHT)
+	{
+		return -EINVAL;
+	}
+	My_driver_lock(my_devp, NULL);
+	ret = My_fair_set_weight(my_devp->ring, req.senderID, req.weight);
+	up(&(my_devp->mutex));
+	return ret;
+}
+
+/**
+ * My_driver_set_ttl() sets the time to live of the tokens of a queue.
+ */
+static long My_driver_set_ttl(struct My_dev *my_devp, unsigned long arg)
+{
+	u64 ttl;
+	if(copy_from_user(&ttl, (void __user *)arg, sizeof(ttl)))
+	{
+		return -EFAULT;
+	}
+	/* Bounded so that the TTL in cycles fits an s64 for any tsc_khz */
+	if(ttl > SQUEUE_MAX_TTL_NS)
+	{
+		return -EINVAL;
+	}
+	My_driver_lock(my_devp, NULL);
+	my_devp->ttlNs = ttl;
+	WRITE_ONCE(my_devp->ttlCycles, ttl ? max_t(u64, mul_u64_u32_div(ttl, tsc_khz, 1000000), 1) : 0);
+	up(&(my_devp->mutex));
+	return 0;
+}
+
+/**
+ * My_driver_ioctl() method attaches and detaches the reader filter of a file,
+ * sets the sender weights of a fair queue and the TTL of a queue.
+ */
+static long My_driver_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct My_file *my_filep = file->private_data;
+	struct My_dev *my_devp = my_filep->my_devp;
+	struct bpf_prog *filter = NULL;
+	struct bpf_prog *old;
+	struct sock_fprog fprog;
+	int ret;
+
+	switch(cmd)
+	{
+	case SQUEUE_IOC_SET_FILTER:
+		if(copy_from_user(&fprog, (void __user *)arg, sizeof(fprog)))
+		{
+			return -EFAULT;
+		}
+		ret = bpf_prog_create_from_user(&filter, &fprog, My_filter_check, false);
+		if(ret)
+		{
+			return ret;
+		}
+		break;
+	case SQUEUE_IOC_CLEAR_FILTER:
+		break;
+	case SQUEUE_IOC_SET_WEIGHT:
+		return My_driver_set_weight(my_devp, arg);
+	case SQUEUE_IOC_SET_TTL:
+		return My_driver_set_ttl(my_devp, arg);
+	default:
+		return -ENOTTY;
+	}
+
+	/* filtered changes with the filter, so open() sees both under My_dev_table_lock */
+	mutex_lock(&My_dev_table_lock);
+	/* Rejected tokens are dropped, so the file must be the only reader */
+	if(filter && (!(file->f_mode & FMODE_READ) || my_devp->readers != 1))
+	{
+		mutex_unlock(&My_dev_table_lock);
+		bpf_prog_destroy(filter);
+		return -EBUSY;
+	}
+	My_driver_lock(my_devp, NULL);
+	old = my_filep->filter;
+	my_filep->filter = filter;
+	up(&(my_devp->mutex));
+	/* Only the single reader holds a filter; other files leave the flag alone */
+	if(filter || old)
+	{
+		my_devp->filtered = filter != NULL;
+	}
+	mutex_unlock(&My_dev_table_lock);
+	if(old)
+	{
+		bpf_prog_destroy(old);
+	}
+	return 0;
+}
+
+/**
+ * My_driver_filter() drops the tokens at the front of the queue that the
+ * reader filter of the file rejects, before they are ever copied.
+ * Called with the device lock held.
+ */
+static void My_driver_filter(struct My_file *my_filep)
+{
+	struct My_dev *my_devp = my_filep->my_devp;
+	MessageToken *front;
+	if(!my_filep->filter)
+	{
+		return;
+	}
+	while((front = My_ring_front(my_devp)) && !bpf_prog_run_pin_on_cpu(my_filep->filter, front))
+	{
+		trace_squeue_filtered(my_devp, front, 0);
+		My_ring_drop(my_devp);
+		this_cpu_inc(my_devp->stats->filtered);
+	}
+}
+
+/**
+ * My_token_age() returns the TSC cycles a token has been queued for. Signed,
+ * a token stamped on a cpu whose TSC is ahead is not expired.
+ */
+static inline s64 My_token_age(const MessageToken *msgtok, unsigned long long now, int isBusIn)
+{
+	return now - (isBusIn ? msgtok->timeStamp2 : msgtok->timeStamp1);
+}
+
+/**
+ * My_driver_expire_fair() expires the tokens of a fair queue. Only the
+ * tokens of one sender are in FIFO order, so every backlogged sub-queue is
+ * expired from its own front.
+ */
+static unsigned int My_driver_expire_fair(struct My_dev *my_devp, unsigned long long now, u64 ttl, int isBusIn)
+{
+	My_fair *fair = my_devp->ring;
+	struct My_sender *sender, *tmp;
+	MessageToken *front;
+	unsigned int expired = 0;
+	s64 age;
+	/* A backlogged sub-queue is never empty */
+	list_for_each_entry_safe(sender, tmp, &fair->activeList, activeNode)
+	{
+		while(1)
+		{
+			front = front_CircularBuffer(&sender->cb);
+			age = My_token_age(front, now, isBusIn);
+			if(age <= (s64)ttl)
+			{
+				break;
+			}
+			trace_squeue_expired(my_devp, front, age);
+			expired++;
+			if(expire_My_fair(fair, sender))
+			{
+				break;
+			}
+		}
+	}
+	return expired;
+}
+
+/**
+ * My_driver_expire() drops the tokens at the front of the queue that have
+ * been queued for longer than the TTL of the queue, all in one pass, and
+ * returns how many. Pollers of stats/expired are woken once per pass.
+ * Called with the device lock held.
+ */
+static unsigned int My_driver_expire(struct My_dev *my_devp)
+{
+	u64 ttl = READ_ONCE(my_devp->ttlCycles);
+	int isBusIn = !strcmp(my_devp->name, DEVICE_NAME1);
+	unsigned long long now;
+	MessageToken *front;
+	unsigned int expired = 0;
+	s64 age;
+	if(!ttl)
+	{
+		return 0;
+	}
+	now = rdtsc();
+	if(my_devp->variant == RING_My_fair)
+	{
+		expired = My_driver_expire_fair(my_devp, now, ttl, isBusIn);
+	}
+	else
+	{
+		while((front = My_ring_front(my_devp)))
+		{
+			age = My_token_age(front, now, isBusIn);
+			if(age <= (s64)ttl)
+			{
+				break;
+			}
+			trace_squeue_expired(my_devp, front, age);
+			My_ring_drop(my_devp);
+			expired++;
+		}
+	}
+	if(expired)
+	{
+		this_cpu_add(my_devp->stats->expired, expired);
+		/* Cached node, sysfs_notify() would look the file up by name */
+		if(my_devp->expiredDirent)
+		{
+			sysfs_notify_dirent(my_devp->expiredDirent);
+		}
+	}
+	return expired;
+}
+
+/**
+ * My_driver_stamp_out() records the time a dequeued token spent in the queue
+ * and returns its accumulated queueing time.
+ */
+static unsigned long long My_driver_stamp_out(struct My_dev *my_devp, MessageToken *msgtok)
+{
+	if(strcmp(my_devp->name, DEVICE_NAME1))
+	{
+		msgtok->timeStamp1 = rdtsc() - msgtok->timeStamp1;
+		return msgtok->timeStamp1 + msgtok->timeStamp2;
+	}
+	msgtok->timeStamp2 = rdtsc() - msgtok->timeStamp2;
+	return msgtok->timeStamp2;
+}
+
+/**
+ * My_driver_read() method is used to copy data from kernel to user space.
+ */
+static ssize_t My_driver_read(struct file *file, char *buf, size_t count, loff_t *ptr)
+{
+	int ret;
+	int res;
+	struct My_file *my_filep = file->private_data;
+	struct My_dev *my_devp = my_filep->my_devp;
+	MessageToken msgtok;
+	unsigned long long latency;
+	My_driver_lock(my_devp, NULL);
+	My_driver_expire(my_devp);
+	My_driver_filter(my_filep);
+	ret = My_ring_dequeue(my_devp, &msgtok);
+
+	if(ret == -1)
+	{
+		//printk("Buffer is empty\n");
+		this_cpu_inc(my_devp->stats->empty_rejects);
+		trace_squeue_empty(my_devp, NULL, 0);
+	}
+	else
+	{
+		latency = My_driver_stamp_out(my_devp, &msgtok);
+		trace_squeue_dequeue(my_devp, &msgtok, latency);
+		/* A reader built with a shorter token gets its prefix */
+		count = min(count, sizeof(MessageToken));
+		res = copy_to_user(buf, &msgtok, count);
+		if(res)
+		{
+			//printk("copy to user fail \n");
+			up(&(my_devp->mutex));
+			return -EFAULT;
+		}
+		this_cpu_inc(my_devp->stats->dequeues);
+		this_cpu_add(my_devp->stats->bytes_copied, count);
+	}
+	up(&(my_devp->mutex));
+	//printk("My_driver_read End\n");
+	return ret;
+}
+
+/**
+ * My_driver_read_iter() method dequeues as many whole tokens as fit in the
+ * destination and returns the number of bytes copied. It backs readv() and,
+ * through copy_splice_read() (generic_file_splice_read() before 6.5),
+ * splice() of tokens straight into a pipe without a copy through user
+ * memory. A token is only removed from the queue once it has been copied.
+ */
+static ssize_t My_driver_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct My_file *my_filep = iocb->ki_filp->private_data;
+	struct My_dev *my_devp = my_filep->my_devp;
+	MessageToken *front;
+	MessageToken msgtok;
+	unsigned long long latency;
+	ssize_t copied = 0;
+
+	if(iov_iter_count(to) < sizeof(MessageToken))
+	{
+		return -EINVAL;
+	}
+	My_driver_lock(my_devp, NULL);
+	while(iov_iter_count(to) >= sizeof(MessageToken))
+	{
+		My_driver_expire(my_devp);
+		My_driver_filter(my_filep);
+		front = My_ring_front(my_devp);
+		if(!front)
+		{
+			break;
+		}
+		msgtok = *front;
+		latency = My_driver_stamp_out(my_devp, &msgtok);
+		if(copy_to_iter(&msgtok, sizeof(MessageToken), to) != sizeof(MessageToken))
+		{
+			if(!copied)
+			{
+				copied = -EFAULT;
+			}
+			break;
+		}
+		My_ring_drop(my_devp);
+		trace_squeue_dequeue(my_devp, &msgtok, latency);
+		copied += sizeof(MessageToken);
+	}
+	if(copied > 0)
+	{
+		this_cpu_add(my_devp->stats->dequeues, copied / sizeof(MessageToken));
+		this_cpu_add(my_devp->stats->bytes_copied, copied);
+	}
+	else if(!copied)
+	{
+		this_cpu_inc(my_devp->stats->empty_rejects);
+		trace_squeue_empty(my_devp, NULL, 0);
+		copied = -EAGAIN;
+	}
+	up(&(my_devp->mutex));
+	return copied;
+}
+
+/**
+ * My_driver_enqueue() stamps a token and adds it to the queue. It returns
+ * the slot used, or -1 if the queue is full.
+ */
+static int My_driver_enqueue(struct My_dev *my_devp, MessageToken *msgtok, size_t count)
+{
+	int ret = -1;
+	struct My_flow *flow = NULL;
+	unsigned int occupancy;
+	unsigned long long latency;
+	/* Writers of the lock-free ring modes are serialized by the ring itself */
+	if(my_devp->ringMode == CB_MODE_LOCKED)
+	{
+		My_driver_lock(my_devp, msgtok);
+	}
+	if(strcmp(my_devp->name, DEVICE_NAME1))
+	{
+		msgtok->timeStamp1 = rdtsc();
+		latency = msgtok->timeStamp2;
+	}
+	else
+	{
+		msgtok->timeStamp2 = rdtsc();
+		latency = 0;
+	}
+	if(my_devp->seq)
+	{
+		flow = My_seq_number(my_devp->seq, msgtok);
+	}
+	if(!my_devp->seq || flow)
+	{
+		ret=My_ring_enqueue(my_devp, msgtok);
+		/* Reclaim the slots of expired tokens; only a locked writer may drop */
+		if(ret == -1 && my_devp->ringMode == CB_MODE_LOCKED && My_driver_expire(my_devp))
+		{
+			ret = My_ring_enqueue(my_devp, msgtok);
+		}
+	}
+	if(ret == -1)
+	{
+		//printk("Buffer is full\n");
+		this_cpu_inc(my_devp->stats->full_rejects);
+		trace_squeue_full(my_devp, msgtok, latency);
+	}
+	else
+	{
+		if(flow)
+		{
+			My_seq_commit(my_devp->seq, flow);
+		}
+		trace_squeue_enqueue(my_devp, msgtok, latency);
+		this_cpu_inc(my_devp->stats->enqueues);
+		this_cpu_add(my_devp->stats->bytes_copied, count);
+		/* Racy between lock-free writers, which may only lose a peak */
+		occupancy = My_ring_count(my_devp);
+		if(occupancy > READ_ONCE(my_devp->peakOccupancy))
+		{
+			WRITE_ONCE(my_devp->peakOccupancy, occupancy);
+		}
+	}
+	if(my_devp->ringMode == CB_MODE_LOCKED)
+	{
+		up(&(my_devp->mutex));
+	}
+	return ret;
+}
+
+/**
+ * My_driver_write() method is used to copy data to kernel from user space.
+ */
+ssize_t My_driver_write(struct file *file, const char *buf, size_t count, loff_t *ppos)
 {
-	struct cdev cdev;               /* The cdev structure */
-	char name[20];                  /* Name of device*/
-	CircularBuffer cb;				/* Circular Buffer*/
-	struct semaphore mutex;		    /* SEMAPHORE per device */
-} *bus_in_q, *bus_out_q1, *bus_out_q2, *bus_out_q3;
+	int res;
+	MessageToken user_msgtoken = {0};
+	struct My_file *my_filep = file->private_data;
+	/* The token is copied before taking the lock to keep the hold time short;
+	 * a short write leaves the rest of it zeroed rather than stack contents */
+	count = min(count, sizeof(MessageToken));
+	res = copy_from_user((void *)&user_msgtoken, (void * __user)buf, count);
+	if(res)
+	{
+		return -EFAULT;
+	}
+	return My_driver_enqueue(my_filep->my_devp, &user_msgtoken, count);
+}
 
-static dev_t my_dev_number;      /* Allotted device number */
-struct class *my_dev_class;      /* Tie with the device model */
+/**
+ * My_driver_write_iter() method enqueues whole tokens from the source until
+ * the queue is full and returns the number of bytes consumed. It backs
+ * writev() and, through iter_file_splice_write(), splice() from a pipe.
+ */
+static ssize_t My_driver_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct My_file *my_filep = iocb->ki_filp->private_data;
+	MessageToken msgtok;
+	ssize_t written = 0;
 
+	if(iov_iter_count(from) < sizeof(MessageToken))
+	{
+		return -EINVAL;
+	}
+	while(iov_iter_count(from) >= sizeof(MessageToken))
+	{
+		if(!copy_from_iter_full(&msgtok, sizeof(MessageToken), from))
+		{
+			return written ? written : -EFAULT;
+		}
+		if(My_driver_enqueue(my_filep->my_devp, &msgtok, sizeof(MessageToken)) == -1)
+		{
+			iov_iter_revert(from, sizeof(MessageToken));
+			break;
+		}
+		written += sizeof(MessageToken);
+	}
+	return written ? written : -EAGAIN;
+}
 
 /**
- * rdtsc() function is used to calulcate the number of clock ticks
- * and measure the time. TSC(time stamp counter) is incremented 
- * every cpu tick (1/CPU_HZ).
- * 
- * Source: http://www.mcs.anl.gov/~kazutomo/rdtsc.html
+ * My_stats_sum() folds one per-cpu counter of a device into a single value.
  */
-static __inline__ unsigned long long rdtsc(void)
+static u64 My_stats_sum(struct My_dev *my_devp, size_t offset)
 {
-	unsigned hi, lo;
-	__asm__ __volatile__ ("rdtsc" : "=a"(lo), "=d"(hi));
-	return ((unsigned long long) lo) | ((unsigned long long) hi)<<32;
+	u64 sum = 0;
+	int cpu;
+	for_each_possible_cpu(cpu)
+	{
+		sum += *(u64 *)((char *)per_cpu_ptr(my_devp->stats, cpu) + offset);
+	}
+	return sum;
 }
 
 /**
- * My_driver_open() method is used by driver to initialize.
+ * Read-only sysfs attribute for a per-cpu counter of struct Queue_stats
  */
-int My_driver_open(struct inode *inode, struct file *file)
+#define QUEUE_STAT_ATTR(field)											\
+static ssize_t field##_show(struct device *dev,							\
+		struct device_attribute *attr, char *buf)						\
+{																		\
+	return sysfs_emit(buf, "%llu\n", My_stats_sum(dev_get_drvdata(dev),	\
+			offsetof(struct Queue_stats, field)));						\
+}																		\
+static DEVICE_ATTR_RO(field)
+
+QUEUE_STAT_ATTR(enqueues);
+QUEUE_STAT_ATTR(dequeues);
+QUEUE_STAT_ATTR(full_rejects);
+QUEUE_STAT_ATTR(empty_rejects);
+QUEUE_STAT_ATTR(filtered);
+QUEUE_STAT_ATTR(expired);
+QUEUE_STAT_ATTR(bytes_copied);
+QUEUE_STAT_ATTR(lock_contended);
+QUEUE_STAT_ATTR(lock_wait_ns);
+
+static ssize_t occupancy_show(struct device *dev, struct device_attribute *attr, char *buf)
 {
-	struct My_dev *my_devp;
-	my_devp = container_of(inode->i_cdev, struct My_dev, cdev);			/* Get the per-device structure that contains this cdev */
-	file->private_data = my_devp;										/* Easy access to cmos_devp from rest of the entry points */
-	//printk("%s has opened\n", my_devp->name);
-	return 0;
+	struct My_dev *my_devp = dev_get_drvdata(dev);
+	return sysfs_emit(buf, "%u\n", My_ring_count(my_devp));
+}
+static DEVICE_ATTR_RO(occupancy);
+
+static ssize_t peak_occupancy_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct My_dev *my_devp = dev_get_drvdata(dev);
+	return sysfs_emit(buf, "%u\n", READ_ONCE(my_devp->peakOccupancy));
+}
+static DEVICE_ATTR_RO(peak_occupancy);
+
+static ssize_t ring_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "%s\n", My_ring_name(dev_get_drvdata(dev)));
+}
+static DEVICE_ATTR_RO(ring);
+
+static ssize_t ttl_ns_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct My_dev *my_devp = dev_get_drvdata(dev);
+	return sysfs_emit(buf, "%llu\n", READ_ONCE(my_devp->ttlNs));
 }
+static DEVICE_ATTR_RO(ttl_ns);
 
 /**
- * My_driver_release() method is used by the driver to 
- * close anything which has been opened and used during driver execution.
+ * Configuration exposed under /sys/class/SMQDriver/<queue>/
  */
-int My_driver_release(struct inode *inode, struct file *file)
+static struct attribute *My_queue_attrs[] =
 {
-	struct My_dev *my_devp = file->private_data;
-	printk("\nMy_driver_release squeue() -- %s is closing\n", my_devp->name);
+		&dev_attr_ring.attr,
+		&dev_attr_ttl_ns.attr,
+		NULL
+};
+
+static const struct attribute_group My_queue_group =
+{
+		.attrs = My_queue_attrs,
+};
+
+/**
+ * Statistics exposed under /sys/class/SMQDriver/<queue>/stats/
+ */
+static struct attribute *My_stats_attrs[] =
+{
+		&dev_attr_enqueues.attr,
+		&dev_attr_dequeues.attr,
+		&dev_attr_full_rejects.attr,
+		&dev_attr_empty_rejects.attr,
+		&dev_attr_filtered.attr,
+		&dev_attr_expired.attr,
+		&dev_attr_bytes_copied.attr,
+		&dev_attr_occupancy.attr,
+		&dev_attr_peak_occupancy.attr,
+		&dev_attr_lock_contended.attr,
+		&dev_attr_lock_wait_ns.attr,
+		NULL
+};
+
+static const struct attribute_group My_stats_group =
+{
+		.name = "stats",
+		.attrs = My_stats_attrs,
+};
+
+static const struct attribute_group *My_dev_groups[] =
+{
+		&My_queue_group,
+		&My_stats_group,
+		NULL
+};
+
+/**
+ * Per sender state of a fair queue in debugfs, one line per sender with
+ * tokens queued or a weight set: senderID, weight, depth, dequeues, average
+ * and maximum time spent in the sub-queue in nanoseconds.
+ */
+static int My_senders_show(struct seq_file *s, void *unused)
+{
+	struct My_dev *my_devp = s->private;
+	struct My_sender *sender;
+	My_fair *fair = my_devp->ring;
+	int bkt;
+
+	if(down_interruptible(&(my_devp->mutex)))
+	{
+		return -ERESTARTSYS;
+	}
+	hash_for_each(fair->senders, bkt, sender, hashNode)
+	{
+		seq_printf(s, "%d %u %u %llu %llu %llu\n",
+				sender->senderID, sender->weight, count_CircularBuffer(&sender->cb),
+				sender->dequeues, sender->dequeues ? div64_u64(sender->latencyNs, sender->dequeues) : 0,
+				sender->maxLatencyNs);
+	}
+	up(&(my_devp->mutex));
 	return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(My_senders);
 
 /**
- * My_driver_read() method is used to copy data from kernel to user space.
+ * File operations structure. Defined in linux/fs.h
  */
-static ssize_t My_driver_read(struct file *file, char *buf, size_t count, loff_t *ptr)
+static struct file_operations My_fops =
+{
+		.owner = THIS_MODULE,           	/* Owner */
+		.open = My_driver_open,              /* Open method */
+		.release = My_driver_release,        /* Release method */
+		.write = My_driver_write,            /* Write method */
+		.read = My_driver_read,				/* Read method */
+		.read_iter = My_driver_read_iter,	/* readv and splice source */
+		.write_iter = My_driver_write_iter,	/* writev and splice sink */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+		.splice_read = copy_splice_read,
+#else
+		.splice_read = generic_file_splice_read,
+#endif
+		.splice_write = iter_file_splice_write,
+		.unlocked_ioctl = My_driver_ioctl	/* ioctl method */
+};
+
+/**
+ * My_dev_find() looks up a queue by name. Called with My_dev_table_lock held.
+ */
+static struct My_dev *My_dev_find(const char *name)
+{
+	struct My_dev *my_devp;
+	int minor;
+	idr_for_each_entry(&My_dev_idr, my_devp, minor)
+	{
+		if(!strcmp(my_devp->name, name))
+		{
+			return my_devp;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * My_dev_destroy() removes a queue from the table and the device model and
+ * frees it. Called with My_dev_table_lock held.
+ */
+static void My_dev_destroy(struct My_dev *my_devp)
+{
+	debugfs_remove_recursive(my_devp->debugfs);
+	sysfs_put(my_devp->expiredDirent);
+	idr_remove(&My_dev_idr, my_devp->minor);
+	device_destroy(my_dev_class, MKDEV(MAJOR(my_dev_number), my_devp->minor));
+	My_ring_free(my_devp);
+	My_seq_free(my_devp->seq);
+	free_percpu(my_devp->stats);
+	kfree(my_devp);
+}
+
+/**
+ * My_dev_create() creates the queue /dev/<name> holding up to capacity tokens
+ * on the first free minor. flags are the SQUEUE_RING_* flags.
+ */
+static int My_dev_create(const char *name, unsigned int capacity, unsigned int flags)
 {
+	struct My_dev *my_devp;
+	struct device *device;
+	struct kernfs_node *stats;
 	int ret;
-	int res;
-	struct My_dev *my_devp = file->private_data;
-	MessageToken msgtok;
-	down(&(my_devp->mutex));
-	ret = dequeue_CircularBuffer(&(my_devp->cb), &msgtok);
 
-	if(ret == -1)
+	if(!name[0] || strchr(name, '/') || !strcmp(name, SQUEUE_CTL_NAME) ||
+		capacity == 0 || capacity > SQUEUE_MAX_CAPACITY)
 	{
-		//printk("Buffer is empty\n");
+		return -EINVAL;
 	}
-	else
+
+	mutex_lock(&My_dev_table_lock);
+	if(My_dev_find(name))
 	{
-		if(strcmp(my_devp->name, DEVICE_NAME1))
-		{
-			msgtok.timeStamp1 = rdtsc() - msgtok.timeStamp1;
-		}
-		else
+		ret = -EEXIST;
+		goto out_unlock;
+	}
+
+	/* Allocate memory for the per-device structure */
+	my_devp = kzalloc(sizeof(struct My_dev), GFP_KERNEL);
+	if(!my_devp)
+	{
+		ret = -ENOMEM;
+		goto out_unlock;
+	}
+	strscpy(my_devp->name, name, SQUEUE_NAME_LEN);
+	sema_init(&(my_devp->mutex),1);
+
+	my_devp->stats = alloc_percpu(struct Queue_stats);
+	if(!my_devp->stats)
+	{
+		ret = -ENOMEM;
+		goto out_free_dev;
+	}
+
+	ret = My_ring_alloc(my_devp, capacity, flags);
+	if(ret)
+	{
+		goto out_free_stats;
+	}
+
+	if(flags & SQUEUE_RING_SEQUENCE)
+	{
+		/* Numbers are taken under the device lock, which lock-free writers skip */
+		if(my_devp->ringMode != CB_MODE_LOCKED)
 		{
-			msgtok.timeStamp2 = rdtsc() - msgtok.timeStamp2;
+			ret = -EINVAL;
+			goto out_clean_cb;
 		}
-		res = copy_to_user(buf, &msgtok, sizeof(MessageToken));
-		if(res)
+		my_devp->seq = My_seq_alloc();
+		if(!my_devp->seq)
 		{
-			//printk("copy to user fail \n");
-			up(&(my_devp->mutex));
-			return -EFAULT;
+			ret = -ENOMEM;
+			goto out_clean_cb;
 		}
 	}
-	up(&(my_devp->mutex));
-	//printk("My_driver_read End\n");
+
+	/* Reserve a minor; open() finds the queue through this table */
+	ret = idr_alloc(&My_dev_idr, my_devp, 1, SQUEUE_MAX_DEVICES, GFP_KERNEL);
+	if(ret < 0)
+	{
+		goto out_clean_cb;
+	}
+	my_devp->minor = ret;
+
+	/* Create the device node along with its sysfs statistics */
+	device = device_create_with_groups(my_dev_class, NULL, MKDEV(MAJOR(my_dev_number), my_devp->minor),
+			my_devp, My_dev_groups, "%s", my_devp->name);
+	if(IS_ERR(device))
+	{
+		ret = PTR_ERR(device);
+		goto out_remove_idr;
+	}
+	stats = sysfs_get_dirent(device->kobj.sd, "stats");
+	if(stats)
+	{
+		my_devp->expiredDirent = sysfs_get_dirent(stats, "expired");
+		sysfs_put(stats);
+	}
+	if(my_devp->variant == RING_My_fair)
+	{
+		/* Not fatal, debugfs may be disabled */
+		my_devp->debugfs = debugfs_create_dir(my_devp->name, my_debugfs_root);
+		debugfs_create_file("senders", 0444, my_devp->debugfs, my_devp, &My_senders_fops);
+	}
+	mutex_unlock(&My_dev_table_lock);
+	printk("Squeue created %s with minor %d, capacity %u and ring %s\n", my_devp->name, my_devp->minor, capacity, My_ring_name(my_devp));
+	return 0;
+
+out_remove_idr:
+	idr_remove(&My_dev_idr, my_devp->minor);
+out_clean_cb:
+	My_seq_free(my_devp->seq);
+	My_ring_free(my_devp);
+out_free_stats:
+	free_percpu(my_devp->stats);
+out_free_dev:
+	kfree(my_devp);
+out_unlock:
+	mutex_unlock(&My_dev_table_lock);
 	return ret;
 }
 
 /**
- * My_driver_write() method is used to copy data to kernel from user space.
+ * My_dev_delete() deletes the queue /dev/<name> unless it is still open.
  */
-ssize_t My_driver_write(struct file *file, const char *buf, size_t count, loff_t *ppos)
+static int My_dev_delete(const char *name)
 {
-	int res;
-	int ret;
-	MessageToken user_msgtoken;
-	struct My_dev *my_devp = file->private_data;
-	down(&(my_devp->mutex));
-	res = copy_from_user((void *)&user_msgtoken, (void * __user)buf, count);
-	if(res)
+	struct My_dev *my_devp;
+	int ret = 0;
+
+	mutex_lock(&My_dev_table_lock);
+	my_devp = My_dev_find(name);
+	if(!my_devp)
 	{
-		up(&(my_devp->mutex));
-		return -EFAULT;
+		ret = -ENOENT;
 	}
-	if(strcmp(my_devp->name, DEVICE_NAME1))
+	else if(my_devp->openCount)
 	{
-		user_msgtoken.timeStamp1 = rdtsc();
+		ret = -EBUSY;
 	}
 	else
 	{
-		user_msgtoken.timeStamp2 = rdtsc();
+		My_dev_destroy(my_devp);
 	}
-	ret=enqueue_CircularBuffer(&(my_devp->cb), &user_msgtoken);
-	if(ret == -1)
+	mutex_unlock(&My_dev_table_lock);
+	return ret;
+}
+
+/**
+ * My_driver_destroy_all() destroys every queue. No queue can be open
+ * as the module is only unloaded once all its files are closed.
+ */
+static void My_driver_destroy_all(void)
+{
+	struct My_dev *my_devp;
+	int minor;
+	mutex_lock(&My_dev_table_lock);
+	idr_for_each_entry(&My_dev_idr, my_devp, minor)
 	{
-		//printk("Buffer is full\n");
+		My_dev_destroy(my_devp);
 	}
-	else
+	mutex_unlock(&My_dev_table_lock);
+	idr_destroy(&My_dev_idr);
+}
+
+/**
+ * My_ctl_ioctl() method of the control node creates and deletes queues.
+ */
+static long My_ctl_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	SqueueQueueReq req;
+
+	if(copy_from_user(&req, (void __user *)arg, sizeof(req)))
 	{
+		return -EFAULT;
+	}
+	req.name[SQUEUE_NAME_LEN - 1] = '\0';
+
+	switch(cmd)
+	{
+	case SQUEUE_IOC_CREATE:
+		return My_dev_create(req.name, req.capacity, req.flags);
+	case SQUEUE_IOC_DELETE:
+		return My_dev_delete(req.name);
+	default:
+		return -ENOTTY;
 	}
-	up(&(my_devp->mutex));
-	return ret;
 }
 
 /**
- * File operations structure. Defined in linux/fs.h
+ * File operations structure of the control node
  */
-static struct file_operations My_fops =
+static struct file_operations My_ctl_fops =
 {
 		.owner = THIS_MODULE,           	/* Owner */
-		.open = My_driver_open,              /* Open method */
-		.release = My_driver_release,        /* Release method */
-		.write = My_driver_write,            /* Write method */
-		.read = My_driver_read				/* Read method */
+		.unlocked_ioctl = My_ctl_ioctl,      /* ioctl method */
 };
 
 /**
@@ -170,10 +1756,17 @@ static struct file_operations My_fops =
  */
 int __init My_driver_init(void)
 {
+	struct device *device;
 	int ret;
 	
+	/* Reader filters address the token through the SQUEUE_FILTER_* offsets */
+	BUILD_BUG_ON(offsetof(MessageToken, msgID) != SQUEUE_FILTER_MSGID);
+	BUILD_BUG_ON(offsetof(MessageToken, senderID) != SQUEUE_FILTER_SENDERID);
+	BUILD_BUG_ON(offsetof(MessageToken, receiverID) != SQUEUE_FILTER_RECEIVERID);
+	BUILD_BUG_ON(offsetof(MessageToken, str_msg) != SQUEUE_FILTER_LEN);
+
 	/* Request dynamic allocation of a device major number */
-	if (alloc_chrdev_region(&my_dev_number, 0, 4, DEVICE_DRIVER_NAME) < 0) //	firstminor = 1 and count = 2
+	if (alloc_chrdev_region(&my_dev_number, 0, SQUEUE_MAX_DEVICES, DEVICE_DRIVER_NAME) < 0)
 	{
 		printk(KERN_DEBUG "Can't register device\n");
 		return -1;
@@ -181,104 +1774,71 @@ int __init My_driver_init(void)
 	printk("Squeue  My major number = %d\n", MAJOR(my_dev_number));
 	
 	/* Populate sysfs entries */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+	my_dev_class = class_create(DEVICE_DRIVER_NAME);
+#else
 	my_dev_class = class_create(THIS_MODULE, DEVICE_DRIVER_NAME);
-	
-	/* Allocate memory for the per-device structure my_devp1 */
-	bus_in_q = kmalloc(sizeof(struct My_dev), GFP_KERNEL);
-	if(!bus_in_q)
-	{
-		printk("Bad Kmalloc bus_in_q\n");
-		return -ENOMEM;
-	}
-	
-	/* Allocate memory for the per-device structure my_devp2*/
-	bus_out_q1 = kmalloc(sizeof(struct My_dev), GFP_KERNEL);
-	if (!bus_out_q1)
-	{
-		printk("Bad Kmalloc bus_out_q1\n");
-		return -ENOMEM;
-	}
-	
-	/* Allocate memory for the per-device structure my_devp2*/
-	bus_out_q2 = kmalloc(sizeof(struct My_dev), GFP_KERNEL);
-	if (!bus_out_q2)
-	{
-		printk("Bad Kmalloc bus_out_q2\n");
-		return -ENOMEM;
-	}
-	
-	/* Allocate memory for the per-device structure my_devp2*/
-	bus_out_q3 = kmalloc(sizeof(struct My_dev), GFP_KERNEL);
-	if (!bus_out_q3)
+#endif
+	if(IS_ERR(my_dev_class))
 	{
-		printk("Bad Kmalloc bus_out_q3\n");
-		return -ENOMEM;
+		ret = PTR_ERR(my_dev_class);
+		goto out_unregister;
 	}
-	
-	/* Request I/O region */
-	sprintf(bus_in_q->name, DEVICE_NAME1);
-	sprintf(bus_out_q1->name, DEVICE_NAME2);
-	sprintf(bus_out_q2->name, DEVICE_NAME3);
-	sprintf(bus_out_q3->name, DEVICE_NAME4);
-
-	/* Connect the file operations with the cdev */
-	cdev_init(&bus_in_q->cdev, &My_fops);
-	cdev_init(&bus_out_q1->cdev, &My_fops);
-	cdev_init(&bus_out_q2->cdev, &My_fops);
-	cdev_init(&bus_out_q3->cdev, &My_fops);
-	bus_in_q->cdev.owner = THIS_MODULE;
-	bus_out_q1->cdev.owner = THIS_MODULE;
-	bus_out_q2->cdev.owner = THIS_MODULE;
-	bus_out_q3->cdev.owner = THIS_MODULE;
-
-	/* Connect the major/minor number to the cdev */
-	ret = cdev_add(&bus_in_q->cdev, MKDEV(MAJOR(my_dev_number), 0), 1);
+
+	/* Connect the file operations with the cdevs, minor 0 is the control node */
+	cdev_init(&my_ctl_cdev, &My_ctl_fops);
+	my_ctl_cdev.owner = THIS_MODULE;
+	ret = cdev_add(&my_ctl_cdev, MKDEV(MAJOR(my_dev_number), 0), 1);
 	if(ret)
 	{
-		printk("Bad cdev for bus_in_q\n");
-		return ret;
+		printk("Bad cdev for %s\n", SQUEUE_CTL_NAME);
+		goto out_class;
 	}
-	ret = cdev_add(&bus_out_q1->cdev, MKDEV(MAJOR(my_dev_number), 1), 1);
+	cdev_init(&my_queue_cdev, &My_fops);
+	my_queue_cdev.owner = THIS_MODULE;
+	ret = cdev_add(&my_queue_cdev, MKDEV(MAJOR(my_dev_number), 1), SQUEUE_MAX_DEVICES - 1);
 	if(ret)
 	{
-		printk("Bad cdev for bus_out_q1\n");
-		return ret;
+		printk("Bad cdev for the queues\n");
+		goto out_ctl_cdev;
 	}
-	ret = cdev_add(&bus_out_q2->cdev, MKDEV(MAJOR(my_dev_number), 2), 1);
-	if(ret)
+	device = device_create(my_dev_class, NULL, MKDEV(MAJOR(my_dev_number), 0), NULL, SQUEUE_CTL_NAME);
+	if(IS_ERR(device))
 	{
-		printk("Bad cdev for bus_out_q2\n");
-		return ret;
+		ret = PTR_ERR(device);
+		goto out_queue_cdev;
 	}
-	ret = cdev_add(&bus_out_q3->cdev, MKDEV(MAJOR(my_dev_number), 3), 1);
-	if(ret)
+
+	my_debugfs_root = debugfs_create_dir(DEVICE_DRIVER_NAME, NULL);
+
+	/* Create the default bus topology */
+	/* bus_in_q numbers the tokens of the senders */
+	if((ret = My_dev_create(DEVICE_NAME1, MAX_QUEUE_SIZE, SQUEUE_RING_SEQUENCE | (fair_bus_in_q ? SQUEUE_RING_FAIR : 0))) ||
+		(ret = My_dev_create(DEVICE_NAME2, MAX_QUEUE_SIZE, 0)) ||
+		(ret = My_dev_create(DEVICE_NAME3, MAX_QUEUE_SIZE, 0)) ||
+		(ret = My_dev_create(DEVICE_NAME4, MAX_QUEUE_SIZE, 0)))
 	{
-		printk("Bad cdev for bus_out_q3\n");
-		return ret;
+		printk("Bad default queues\n");
+		goto out_queues;
 	}
-	
-	device_create(my_dev_class, NULL, MKDEV(MAJOR(my_dev_number), 0), NULL, DEVICE_NAME1);
-	device_create(my_dev_class, NULL, MKDEV(MAJOR(my_dev_number), 1), NULL, DEVICE_NAME2);
-	device_create(my_dev_class, NULL, MKDEV(MAJOR(my_dev_number), 2), NULL, DEVICE_NAME3);
-	device_create(my_dev_class, NULL, MKDEV(MAJOR(my_dev_number), 3), NULL, DEVICE_NAME4);
-	
-	/* Initialize the Circular Buffer */
-	init_CircularBuffer(&(bus_in_q->cb));
-	init_CircularBuffer(&(bus_out_q1->cb));
-	init_CircularBuffer(&(bus_out_q2->cb));
-	init_CircularBuffer(&(bus_out_q3->cb));
-	printk("Circular Buffer initialized\n");
-	
-	/* Initialize the semaphore */
-	sema_init(&(bus_in_q->mutex),1);
-	sema_init(&(bus_out_q1->mutex),1);
-	sema_init(&(bus_out_q2->mutex),1);
-	sema_init(&(bus_out_q3->mutex),1);
-	printk("Semaphores Initialized\n");
 
 	printk("My Driver = %s Initialized.\n", DEVICE_DRIVER_NAME);
 	printk("Squeue.c My_driver_init() End \n");
 	return 0;
+
+out_queues:
+	My_driver_destroy_all();
+	debugfs_remove_recursive(my_debugfs_root);
+	device_destroy(my_dev_class, MKDEV(MAJOR(my_dev_number), 0));
+out_queue_cdev:
+	cdev_del(&my_queue_cdev);
+out_ctl_cdev:
+	cdev_del(&my_ctl_cdev);
+out_class:
+	class_destroy(my_dev_class);
+out_unregister:
+	unregister_chrdev_region(my_dev_number, SQUEUE_MAX_DEVICES);
+	return ret;
 }
 
 /**
@@ -287,31 +1847,18 @@ int __init My_driver_init(void)
 void __exit My_driver_exit(void)
 {
 	printk("My_driver_exit() Start\n");
-	/* Destroy device with Minor Number 0*/
-	device_destroy (my_dev_class, MKDEV(MAJOR(my_dev_number), 0));
-	cdev_del(&bus_in_q->cdev);
-	kfree(bus_in_q);
-	
-	/* Destroy device with Minor Number 1*/
-	device_destroy (my_dev_class, MKDEV(MAJOR(my_dev_number), 1));
-	cdev_del(&bus_out_q1->cdev);
-	kfree(bus_out_q1);
-	
-	/* Destroy device with Minor Number 2*/
-	device_destroy (my_dev_class, MKDEV(MAJOR(my_dev_number), 2));
-	cdev_del(&bus_out_q2->cdev);
-	kfree(bus_out_q2);
-	
-	/* Destroy device with Minor Number 3*/
-	device_destroy (my_dev_class, MKDEV(MAJOR(my_dev_number), 3));
-	cdev_del(&bus_out_q3->cdev);
-	kfree(bus_out_q3);
-	
+	/* Destroy the queues and the control node */
+	My_driver_destroy_all();
+	debugfs_remove_recursive(my_debugfs_root);
+	device_destroy(my_dev_class, MKDEV(MAJOR(my_dev_number), 0));
+	cdev_del(&my_queue_cdev);
+	cdev_del(&my_ctl_cdev);
+
 	/* Destroy driver_class */
 	class_destroy(my_dev_class);
 
 	/* Release the major number */
-	unregister_chrdev_region((my_dev_number), 1);
+	unregister_chrdev_region(my_dev_number, SQUEUE_MAX_DEVICES);
 	printk("My_driver_exit() End\n");
 }
 
@@ -0,0 +1,876 @@
+/******************************************************************************
+ *
+ * File Name: Squeue_bench.c
+ *
+ * Description: Benchmarks of the shared queue driver. Each benchmark creates
+ * its own queues through /dev/squeue_ctl and deletes them when it is done.
+ * Usage: ./Squeue_bench.o <benchmark>
+ *
+ *****************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <pthread.h>
+#include <sched.h>
+#include "Squeue_ioctl.h"
+#include "Squeue_router.h"
+
+#define BENCH_QUEUE_CAPACITY 1024
+#define BENCH_ROUNDS 200
+#define NUMBER_OF_SENDERS 100
+#define FORWARD_TOKENS 200000
+#define FORWARD_BATCH 64			//Tokens moved per splice()
+#define FAIR_QUEUE_CAPACITY 10		//As bus_in_q
+#define FAIR_LIGHT_SENDERS 3
+#define FAIR_LIGHT_PERIOD_US 1000	//Interval between tokens of a light sender
+#define FAIR_SERVICE_NS 20000		//Time the reader spends on each token
+#define FAIR_DURATION_NS 2000000000ULL
+#define FAIR_MAX_SAMPLES 200000
+#define TTL_NS 1000000				//TTL of the ttl benchmark, 1 mS
+#define ROUTER_RECEIVERS 8
+#define ROUTER_QUEUE_CAPACITY 10	//As bus_out_qN
+#define ROUTER_TOKENS 400000		//Multiple of ROUTER_RECEIVERS
+
+/**
+ * Result of draining a queue
+ */
+typedef struct
+{
+	unsigned long reads;		//read() system calls
+	unsigned long copied;		//tokens copied to user space
+	unsigned long kept;			//tokens the reader wanted
+	unsigned long long ns;		//time spent draining
+}DrainResult;
+
+/**
+ * Benchmark table
+ */
+typedef struct
+{
+	const char *name;
+	int (*run)(int fd_ctl);
+	const char *help;
+}Benchmark;
+
+int benchFilter(int fd_ctl);
+int benchForward(int fd_ctl);
+int benchFair(int fd_ctl);
+int benchRouter(int fd_ctl);
+int benchTtl(int fd_ctl);
+
+static Benchmark benchmarks[] =
+{
+	{ "filter", benchFilter, "reader filter in the driver vs. filtering in user space" },
+	{ "forward", benchForward, "forward-only receiver, read()+write() vs. splice() to a socket" },
+	{ "fair", benchFair, "latency of light senders next to a heavy one, FIFO vs. fair queue" },
+	{ "router", benchRouter, "bus router throughput by number of workers" },
+	{ "ttl", benchTtl, "latency of delivered tokens in an overloaded queue, with and without TTL" },
+};
+
+/**
+ * Function to get a monotonic timestamp in nS.
+ */
+unsigned long long nowNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Function to create the queue /dev/<name> with SQUEUE_RING_* flags and
+ * open it.
+ */
+int createQueue(int fd_ctl, const char *name, unsigned int capacity, unsigned int flags)
+{
+	SqueueQueueReq req;
+	char path[SQUEUE_NAME_LEN + 8];
+	int fd = -1;
+	int retries;
+	memset(&req, 0, sizeof(req));
+	snprintf(req.name, sizeof(req.name), "%s", name);
+	req.capacity = capacity;
+	req.flags = flags;
+	if(ioctl(fd_ctl, SQUEUE_IOC_CREATE, &req) < 0)
+	{
+		printf("Can not create queue %s: %s\n", name, strerror(errno));
+		return -1;
+	}
+	sprintf(path, "/dev/%s", name);
+	/* udev creates the device node asynchronously */
+	for(retries = 0; retries < 100; retries++)
+	{
+		fd = open(path, O_RDWR);
+		if(fd >= 0 || errno != ENOENT)
+		{
+			break;
+		}
+		usleep(10000);
+	}
+	return fd;
+}
+
+/**
+ * Function to close and delete the queue /dev/<name>.
+ */
+void deleteQueue(int fd_ctl, int fd, const char *name)
+{
+	SqueueQueueReq req;
+	close(fd);
+	memset(&req, 0, sizeof(req));
+	snprintf(req.name, sizeof(req.name), "%s", name);
+	ioctl(fd_ctl, SQUEUE_IOC_DELETE, &req);
+}
+
+/**
+ * Function to fill a queue with tokens from NUMBER_OF_SENDERS senders.
+ */
+void fillQueue(int fd, int count)
+{
+	MessageToken tok;
+	int i;
+	memset(&tok, 0, sizeof(tok));
+	for(i=0;i<count;i++)
+	{
+		tok.msgID = i;
+		tok.senderID = (i % NUMBER_OF_SENDERS) + 1;
+		tok.receiverID = 1;
+		if(write(fd, &tok, sizeof(MessageToken)) == -1)
+		{
+			break;
+		}
+	}
+}
+
+/**
+ * Function to drain a queue, keeping the tokens of senders up to maxSender.
+ */
+void drainQueue(int fd, int maxSender, DrainResult *result)
+{
+	MessageToken tok;
+	unsigned long long start = nowNs();
+	while(1)
+	{
+		result->reads++;
+		if(read(fd, &tok, sizeof(MessageToken)) == -1)
+		{
+			break;
+		}
+		result->copied++;
+		if(tok.senderID <= maxSender)
+		{
+			result->kept++;
+		}
+	}
+	result->ns += nowNs() - start;
+}
+
+/**
+ * Function to attach a filter accepting the senders up to maxSender.
+ */
+int attachSenderFilter(int fd, int maxSender)
+{
+	struct sock_filter code[] =
+	{
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SQUEUE_FILTER_SENDERID),
+		BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, maxSender, 1, 0),
+		BPF_STMT(BPF_RET | BPF_K, 1),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+	struct sock_fprog prog = { sizeof(code) / sizeof(code[0]), code };
+	return ioctl(fd, SQUEUE_IOC_SET_FILTER, &prog);
+}
+
+/**
+ * Reader filter benchmark. A reader wants the tokens of a fraction of the
+ * senders. It either reads every token and discards the others itself, or
+ * attaches a filter so that the driver drops them before they are copied.
+ */
+int benchFilter(int fd_ctl)
+{
+	static const int selectivity[] = { 1, 10, 25, 50, 100 };
+	DrainResult user, driver;
+	int fd;
+	int i, round;
+
+	fd = createQueue(fd_ctl, "bench_filter_q", BENCH_QUEUE_CAPACITY, 0);
+	if(fd < 0)
+	{
+		return -1;
+	}
+	printf("selectivity  mode    reads/kept  bytes/kept  nS/kept\n");
+	for(i=0;i<sizeof(selectivity)/sizeof(selectivity[0]);i++)
+	{
+		int maxSender = NUMBER_OF_SENDERS * selectivity[i] / 100;
+		memset(&user, 0, sizeof(user));
+		memset(&driver, 0, sizeof(driver));
+
+		ioctl(fd, SQUEUE_IOC_CLEAR_FILTER);
+		for(round=0;round<BENCH_ROUNDS;round++)
+		{
+			fillQueue(fd, BENCH_QUEUE_CAPACITY);
+			drainQueue(fd, maxSender, &user);
+		}
+
+		if(attachSenderFilter(fd, maxSender) < 0)
+		{
+			printf("Can not attach filter: %s\n", strerror(errno));
+			deleteQueue(fd_ctl, fd, "bench_filter_q");
+			return -1;
+		}
+		for(round=0;round<BENCH_ROUNDS;round++)
+		{
+			fillQueue(fd, BENCH_QUEUE_CAPACITY);
+			drainQueue(fd, maxSender, &driver);
+		}
+
+		printf("%10d%%  user    %10.2f  %10.1f  %7.0f\n", selectivity[i],
+			(double)user.reads / user.kept, (double)user.copied * sizeof(MessageToken) / user.kept,
+			(double)user.ns / user.kept);
+		printf("%10d%%  driver  %10.2f  %10.1f  %7.0f\n", selectivity[i],
+			(double)driver.reads / driver.kept, (double)driver.copied * sizeof(MessageToken) / driver.kept,
+			(double)driver.ns / driver.kept);
+	}
+	deleteQueue(fd_ctl, fd, "bench_filter_q");
+	return 0;
+}
+
+/**
+ * Arguments of the forward benchmark threads
+ */
+typedef struct
+{
+	int fd;
+	unsigned long tokens;
+}ForwardParams;
+
+/**
+ * Function called by the producer thread of the forward benchmark to write
+ * tokens into the queue, retrying while it is full.
+ */
+void *forwardProducer(void *data)
+{
+	ForwardParams *params = (ForwardParams*)data;
+	MessageToken tok;
+	unsigned long i;
+	memset(&tok, 0, sizeof(tok));
+	for(i=0;i<params->tokens;i++)
+	{
+		tok.msgID = i;
+		tok.senderID = 1;
+		tok.receiverID = 1;
+		while(write(params->fd, &tok, sizeof(MessageToken)) == -1)
+		{
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Function called by the sink thread of the forward benchmark to read and
+ * discard what the receiver forwards to the socket.
+ */
+void *forwardSink(void *data)
+{
+	ForwardParams *params = (ForwardParams*)data;
+	char buf[FORWARD_BATCH * sizeof(MessageToken)];
+	unsigned long total = params->tokens * sizeof(MessageToken);
+	unsigned long received = 0;
+	ssize_t res;
+	while(received < total)
+	{
+		res = read(params->fd, buf, sizeof(buf));
+		if(res <= 0)
+		{
+			break;
+		}
+		received += res;
+	}
+	return NULL;
+}
+
+/**
+ * Function to forward tokens one at a time with read() and write().
+ */
+int forwardCopy(int fd_q, int fd_out, unsigned long tokens, unsigned long *syscalls)
+{
+	MessageToken tok;
+	unsigned long forwarded = 0;
+	while(forwarded < tokens)
+	{
+		(*syscalls)++;
+		if(read(fd_q, &tok, sizeof(MessageToken)) == -1)
+		{
+			sched_yield();
+			continue;
+		}
+		(*syscalls)++;
+		if(write(fd_out, &tok, sizeof(MessageToken)) != sizeof(MessageToken))
+		{
+			return -1;
+		}
+		forwarded++;
+	}
+	return 0;
+}
+
+/**
+ * Function to forward tokens with splice() through a pipe, so that they
+ * never pass through user memory.
+ */
+int forwardSplice(int fd_q, int fd_out, unsigned long tokens, unsigned long *syscalls)
+{
+	int pipefd[2];
+	unsigned long total = tokens * sizeof(MessageToken);
+	unsigned long forwarded = 0;
+	ssize_t in, out;
+	if(pipe(pipefd) < 0)
+	{
+		return -1;
+	}
+	while(forwarded < total)
+	{
+		(*syscalls)++;
+		in = splice(fd_q, NULL, pipefd[1], NULL, FORWARD_BATCH * sizeof(MessageToken), 0);
+		if(in < 0 && errno == EAGAIN)
+		{
+			sched_yield();
+			continue;
+		}
+		if(in <= 0)
+		{
+			printf("splice from queue failed: %s\n", strerror(errno));
+			break;
+		}
+		while(in > 0)
+		{
+			(*syscalls)++;
+			out = splice(pipefd[0], NULL, fd_out, NULL, in, SPLICE_F_MOVE);
+			if(out <= 0)
+			{
+				printf("splice to socket failed: %s\n", strerror(errno));
+				close(pipefd[0]);
+				close(pipefd[1]);
+				return -1;
+			}
+			in -= out;
+			forwarded += out;
+		}
+	}
+	close(pipefd[0]);
+	close(pipefd[1]);
+	return forwarded == total ? 0 : -1;
+}
+
+/**
+ * Forward benchmark. A receiver forwards every token of a queue to a socket,
+ * either by copying it through user memory or with splice().
+ */
+int benchForward(int fd_ctl)
+{
+	static const char *modes[] = { "read+write", "splice" };
+	ForwardParams producer, sink;
+	pthread_t thread_p, thread_s;
+	unsigned long long start, ns;
+	unsigned long syscalls;
+	int sv[2];
+	int fd;
+	int mode, ret;
+
+	fd = createQueue(fd_ctl, "bench_fwd_q", BENCH_QUEUE_CAPACITY, 0);
+	if(fd < 0)
+	{
+		return -1;
+	}
+	printf("mode        tokens/s  syscalls/token  nS/token\n");
+	for(mode=0;mode<2;mode++)
+	{
+		if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+		{
+			printf("Can not create socket pair: %s\n", strerror(errno));
+			break;
+		}
+		producer.fd = fd;
+		producer.tokens = FORWARD_TOKENS;
+		sink.fd = sv[1];
+		sink.tokens = FORWARD_TOKENS;
+		syscalls = 0;
+		start = nowNs();
+		pthread_create(&thread_s, NULL, &forwardSink, (void*)&sink);
+		pthread_create(&thread_p, NULL, &forwardProducer, (void*)&producer);
+		if(mode == 0)
+		{
+			ret = forwardCopy(fd, sv[0], FORWARD_TOKENS, &syscalls);
+		}
+		else
+		{
+			ret = forwardSplice(fd, sv[0], FORWARD_TOKENS, &syscalls);
+		}
+		pthread_join(thread_p, NULL);
+		if(ret < 0)
+		{
+			shutdown(sv[0], SHUT_RDWR);
+		}
+		pthread_join(thread_s, NULL);
+		ns = nowNs() - start;
+		close(sv[0]);
+		close(sv[1]);
+		if(ret < 0)
+		{
+			printf("%-10s  failed\n", modes[mode]);
+			continue;
+		}
+		printf("%-10s  %8.0f  %14.2f  %8.0f\n", modes[mode], FORWARD_TOKENS * 1e9 / ns,
+			(double)syscalls / FORWARD_TOKENS, (double)ns / FORWARD_TOKENS);
+	}
+	deleteQueue(fd_ctl, fd, "bench_fwd_q");
+	return 0;
+}
+
+/**
+ * Arguments of the fair benchmark sender threads. A sender with period 0
+ * writes as fast as the queue accepts tokens.
+ */
+typedef struct
+{
+	int fd;
+	int senderID;
+	unsigned int periodUs;
+	volatile int *stop;
+}FairSender;
+
+/**
+ * Latency samples of one class of senders
+ */
+typedef struct
+{
+	unsigned long long *ns;
+	unsigned long count;
+}FairSamples;
+
+/**
+ * Function called by the sender threads of the fair benchmark. The time a
+ * token is first offered is carried in str_msg, so that the latency seen by
+ * the reader includes the retries while the queue was full.
+ */
+void *fairSender(void *data)
+{
+	FairSender *params = (FairSender*)data;
+	MessageToken tok;
+	unsigned long long sent;
+	memset(&tok, 0, sizeof(tok));
+	tok.senderID = params->senderID;
+	tok.receiverID = 1;
+	while(!*params->stop)
+	{
+		sent = nowNs();
+		memcpy(tok.str_msg, &sent, sizeof(sent));
+		while(write(params->fd, &tok, sizeof(MessageToken)) == -1 && !*params->stop)
+		{
+			sched_yield();
+		}
+		tok.msgID++;
+		if(params->periodUs)
+		{
+			usleep(params->periodUs);
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Function to compare two latency samples for qsort()
+ */
+int compareNs(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * Function to print the latency percentiles of a class of senders.
+ */
+void printSamples(const char *mode, const char *senders, FairSamples *samples)
+{
+	unsigned long n = samples->count;
+	if(!n)
+	{
+		printf("%-5s  %-7s  %8d\n", mode, senders, 0);
+		return;
+	}
+	qsort(samples->ns, n, sizeof(samples->ns[0]), compareNs);
+	printf("%-5s  %-7s  %8lu  %8.1f  %8.1f  %8.1f\n", mode, senders, n,
+		samples->ns[(n - 1) * 50 / 100] / 1e3, samples->ns[(n - 1) * 99 / 100] / 1e3,
+		samples->ns[n - 1] / 1e3);
+}
+
+/**
+ * Fair queueing benchmark. Sender 1 writes as fast as it can while
+ * FAIR_LIGHT_SENDERS light senders write a token every FAIR_LIGHT_PERIOD_US
+ * into a bus_in_q sized queue, and a reader that spends FAIR_SERVICE_NS on
+ * each token is the bottleneck. In a FIFO queue the heavy sender keeps the
+ * queue full, so a light token waits behind a full queue and for a free slot
+ * first; in a fair queue it waits for at most one round.
+ */
+int benchFair(int fd_ctl)
+{
+	static const char *modes[] = { "fifo", "fair" };
+	static const unsigned int flags[] = { 0, SQUEUE_RING_FAIR };
+	FairSender senders[1 + FAIR_LIGHT_SENDERS];
+	pthread_t threads[1 + FAIR_LIGHT_SENDERS];
+	FairSamples heavy, light;
+	MessageToken tok;
+	unsigned long long start, now, sent;
+	volatile int stop;
+	int fd;
+	int mode, i;
+
+	heavy.ns = malloc(FAIR_MAX_SAMPLES * sizeof(heavy.ns[0]));
+	light.ns = malloc(FAIR_MAX_SAMPLES * sizeof(light.ns[0]));
+	if(!heavy.ns || !light.ns)
+	{
+		free(heavy.ns);
+		free(light.ns);
+		return -1;
+	}
+	printf("mode   senders    tokens   p50(uS)   p99(uS)   max(uS)\n");
+	for(mode=0;mode<2;mode++)
+	{
+		fd = createQueue(fd_ctl, "bench_fair_q", FAIR_QUEUE_CAPACITY, flags[mode]);
+		if(fd < 0)
+		{
+			break;
+		}
+		heavy.count = 0;
+		light.count = 0;
+		stop = 0;
+		for(i=0;i<1 + FAIR_LIGHT_SENDERS;i++)
+		{
+			senders[i].fd = fd;
+			senders[i].senderID = i + 1;
+			senders[i].periodUs = i ? FAIR_LIGHT_PERIOD_US : 0;
+			senders[i].stop = &stop;
+			pthread_create(&threads[i], NULL, &fairSender, (void*)&senders[i]);
+		}
+		start = nowNs();
+		do
+		{
+			if(read(fd, &tok, sizeof(MessageToken)) == -1)
+			{
+				now = nowNs();
+				continue;
+			}
+			now = nowNs();
+			memcpy(&sent, tok.str_msg, sizeof(sent));
+			if(tok.senderID == 1 && heavy.count < FAIR_MAX_SAMPLES)
+			{
+				heavy.ns[heavy.count++] = now - sent;
+			}
+			else if(tok.senderID != 1 && light.count < FAIR_MAX_SAMPLES)
+			{
+				light.ns[light.count++] = now - sent;
+			}
+			/* Work of the router on the token */
+			while(nowNs() - now < FAIR_SERVICE_NS);
+		} while(now - start < FAIR_DURATION_NS);
+		stop = 1;
+		for(i=0;i<1 + FAIR_LIGHT_SENDERS;i++)
+		{
+			pthread_join(threads[i], NULL);
+		}
+		printSamples(modes[mode], "heavy", &heavy);
+		printSamples(modes[mode], "light", &light);
+		deleteQueue(fd_ctl, fd, "bench_fair_q");
+	}
+	free(heavy.ns);
+	free(light.ns);
+	return mode == 2 ? 0 : -1;
+}
+
+/**
+ * Arguments of the router benchmark threads
+ */
+typedef struct
+{
+	int fd;
+	int receiverID;
+	unsigned long tokens;
+}RouterParams;
+
+/**
+ * Function called by the producer thread of the router benchmark to write
+ * tokens for all receivers in turn, retrying while the queue is full.
+ */
+void *routerProducer(void *data)
+{
+	RouterParams *params = (RouterParams*)data;
+	MessageToken tok;
+	unsigned long i;
+	memset(&tok, 0, sizeof(tok));
+	tok.senderID = 1;
+	for(i=0;i<params->tokens;i++)
+	{
+		tok.msgID = i;
+		tok.receiverID = (i % ROUTER_RECEIVERS) + 1;
+		while(write(params->fd, &tok, sizeof(MessageToken)) == -1)
+		{
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Function called by the receiver threads of the router benchmark to read
+ * their tokens one at a time.
+ */
+void *routerReceiver(void *data)
+{
+	RouterParams *params = (RouterParams*)data;
+	MessageToken tok;
+	unsigned long received = 0;
+	while(received < params->tokens)
+	{
+		if(read(params->fd, &tok, sizeof(MessageToken)) == -1)
+		{
+			sched_yield();
+			continue;
+		}
+		received++;
+	}
+	return NULL;
+}
+
+/**
+ * Router benchmark. A producer writes ROUTER_TOKENS tokens spread over
+ * ROUTER_RECEIVERS receivers into an input queue, and the router moves them
+ * to the bus_out_qN sized queue of each receiver with 1 to 8 workers.
+ */
+int benchRouter(int fd_ctl)
+{
+	static const int workers[] = { 1, 2, 4, 8 };
+	int fd_out[ROUTER_RECEIVERS];
+	int routeTable[ROUTER_RECEIVERS + 1];
+	char name[SQUEUE_NAME_LEN];
+	RouterParams producer, receivers[ROUTER_RECEIVERS];
+	pthread_t thread_p, thread_r[ROUTER_RECEIVERS];
+	Router router;
+	unsigned long long start, ns;
+	unsigned long routed, writes, full;
+	double base = 1;
+	int fd_in;
+	int i, w, r;
+	int ret = 0;
+
+	fd_in = createQueue(fd_ctl, "bench_rt_in", BENCH_QUEUE_CAPACITY, 0);
+	if(fd_in < 0)
+	{
+		return -1;
+	}
+	routeTable[0] = -1;
+	for(r=0;r<ROUTER_RECEIVERS;r++)
+	{
+		snprintf(name, sizeof(name), "bench_rt_out%d", r + 1);
+		fd_out[r] = createQueue(fd_ctl, name, ROUTER_QUEUE_CAPACITY, 0);
+		if(fd_out[r] < 0)
+		{
+			ret = -1;
+			goto out;
+		}
+		routeTable[r + 1] = fd_out[r];
+	}
+	printf("workers  tokens/s  speedup  tokens/writev  full writes\n");
+	for(i=0;i<sizeof(workers)/sizeof(workers[0]);i++)
+	{
+		producer.fd = fd_in;
+		producer.tokens = ROUTER_TOKENS;
+		start = nowNs();
+		if(routerStart(&router, fd_in, routeTable, ROUTER_RECEIVERS, workers[i], NULL))
+		{
+			printf("Can not start the router\n");
+			ret = -1;
+			goto out;
+		}
+		for(r=0;r<ROUTER_RECEIVERS;r++)
+		{
+			receivers[r].fd = fd_out[r];
+			receivers[r].receiverID = r + 1;
+			receivers[r].tokens = ROUTER_TOKENS / ROUTER_RECEIVERS;
+			pthread_create(&thread_r[r], NULL, &routerReceiver, (void*)&receivers[r]);
+		}
+		pthread_create(&thread_p, NULL, &routerProducer, (void*)&producer);
+		pthread_join(thread_p, NULL);
+		routerStop(&router);
+		for(r=0;r<ROUTER_RECEIVERS;r++)
+		{
+			pthread_join(thread_r[r], NULL);
+		}
+		ns = nowNs() - start;
+		routed = writes = full = 0;
+		for(w=0;w<workers[i];w++)
+		{
+			routed += router.workers[w].routed;
+			writes += router.workers[w].writes;
+			full += router.workers[w].full;
+		}
+		routerFree(&router);
+		if(!i)
+		{
+			base = routed * 1e9 / ns;
+		}
+		/* No writes, or none accepted, if nothing was routed */
+		printf("%7d  %8.0f  %7.2f  %13.2f  %10.1f%%\n", workers[i], routed * 1e9 / ns,
+			base ? routed * 1e9 / ns / base : 0, writes > full ? (double)routed / (writes - full) : 0,
+			writes ? 100.0 * full / writes : 0);
+	}
+out:
+	while(r-- > 0)
+	{
+		snprintf(name, sizeof(name), "bench_rt_out%d", r + 1);
+		deleteQueue(fd_ctl, fd_out[r], name);
+	}
+	deleteQueue(fd_ctl, fd_in, "bench_rt_in");
+	return ret;
+}
+
+/**
+ * Function to read a counter from /sys/class/SMQDriver/<name>/stats/
+ */
+unsigned long long readStat(const char *name, const char *stat)
+{
+	char path[128];
+	unsigned long long value = 0;
+	FILE *fp;
+	snprintf(path, sizeof(path), "/sys/class/SMQDriver/%s/stats/%s", name, stat);
+	fp = fopen(path, "r");
+	if(fp)
+	{
+		if(fscanf(fp, "%llu", &value) != 1)
+		{
+			value = 0;
+		}
+		fclose(fp);
+	}
+	return value;
+}
+
+/**
+ * TTL benchmark. A sender writes as fast as it can into a queue of
+ * BENCH_QUEUE_CAPACITY tokens while a reader spending FAIR_SERVICE_NS on each
+ * token falls behind. Without a TTL every token waits behind the whole
+ * backlog; with one the reader skips the tokens older than TTL_NS and only
+ * spends time on fresh ones.
+ */
+int benchTtl(int fd_ctl)
+{
+	static const char *modes[] = { "none", "1mS" };
+	static const unsigned long long ttls[] = { 0, TTL_NS };
+	FairSender sender;
+	pthread_t thread;
+	FairSamples samples;
+	MessageToken tok;
+	unsigned long long start, now, sent;
+	volatile int stop;
+	int fd;
+	int mode;
+
+	samples.ns = malloc(FAIR_MAX_SAMPLES * sizeof(samples.ns[0]));
+	if(!samples.ns)
+	{
+		return -1;
+	}
+	printf("ttl    senders    tokens   p50(uS)   p99(uS)   max(uS)\n");
+	for(mode=0;mode<2;mode++)
+	{
+		fd = createQueue(fd_ctl, "bench_ttl_q", BENCH_QUEUE_CAPACITY, 0);
+		if(fd < 0)
+		{
+			break;
+		}
+		if(ioctl(fd, SQUEUE_IOC_SET_TTL, &ttls[mode]) < 0)
+		{
+			printf("Can not set TTL: %s\n", strerror(errno));
+			deleteQueue(fd_ctl, fd, "bench_ttl_q");
+			break;
+		}
+		samples.count = 0;
+		stop = 0;
+		sender.fd = fd;
+		sender.senderID = 1;
+		sender.periodUs = 0;
+		sender.stop = &stop;
+		pthread_create(&thread, NULL, &fairSender, (void*)&sender);
+		start = nowNs();
+		do
+		{
+			if(read(fd, &tok, sizeof(MessageToken)) == -1)
+			{
+				now = nowNs();
+				continue;
+			}
+			now = nowNs();
+			memcpy(&sent, tok.str_msg, sizeof(sent));
+			if(samples.count < FAIR_MAX_SAMPLES)
+			{
+				samples.ns[samples.count++] = now - sent;
+			}
+			/* Work of the receiver on the token */
+			while(nowNs() - now < FAIR_SERVICE_NS);
+		} while(now - start < FAIR_DURATION_NS);
+		stop = 1;
+		pthread_join(thread, NULL);
+		printSamples(modes[mode], "all", &samples);
+		printf("%-5s  expired   %8llu\n", modes[mode], readStat("bench_ttl_q", "expired"));
+		deleteQueue(fd_ctl, fd, "bench_ttl_q");
+	}
+	free(samples.ns);
+	return mode == 2 ? 0 : -1;
+}
+
+/**
+ * Main Function
+ */
+int main(int argc, char **argv)
+{
+	int fd_ctl;
+	int i;
+	if(argc < 2)
+	{
+		printf("Usage: %s <benchmark>\n", argv[0]);
+		for(i=0;i<sizeof(benchmarks)/sizeof(benchmarks[0]);i++)
+		{
+			printf("  %-10s %s\n", benchmarks[i].name, benchmarks[i].help);
+		}
+		return 1;
+	}
+	fd_ctl = open("/dev/" SQUEUE_CTL_NAME, O_RDWR);
+	if(fd_ctl < 0)
+	{
+		printf("Can not open device file %s.\n", SQUEUE_CTL_NAME);
+		return 1;
+	}
+	for(i=0;i<sizeof(benchmarks)/sizeof(benchmarks[0]);i++)
+	{
+		if(!strcmp(argv[1], benchmarks[i].name))
+		{
+			i = benchmarks[i].run(fd_ctl);
+			close(fd_ctl);
+			return i ? 1 : 0;
+		}
+	}
+	printf("Unknown benchmark %s\n", argv[1]);
+	close(fd_ctl);
+	return 1;
+}
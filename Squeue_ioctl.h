@@ -0,0 +1,169 @@
+/******************************************************************************
+ *
+ * File Name: Squeue_ioctl.h
+ *
+ * Description: ioctl interface of driver Squeue.c, shared by the driver and
+ * the user space programs. Queues are created and deleted at runtime through
+ * the control node /dev/squeue_ctl.
+ *
+ *****************************************************************************/
+
+#ifndef SQUEUE_IOCTL_H
+#define SQUEUE_IOCTL_H
+
+#include <linux/ioctl.h>
+#include <linux/filter.h>
+
+/**
+ * Name of the control node
+ */
+#define SQUEUE_CTL_NAME "squeue_ctl"
+
+/**
+ * Maximum length of a queue name, including the terminating '\0'
+ */
+#define SQUEUE_NAME_LEN 20
+
+/**
+ * Maximum number of tokens a single queue can hold
+ */
+#define SQUEUE_MAX_CAPACITY 65536
+
+/**
+ * Ring flags of SqueueQueueReq. Without flags a queue is a locked ring
+ * whose slots are allocated once when the queue is created.
+ * SQUEUE_RING_DYNAMIC - allocate every token on enqueue instead
+ * SQUEUE_RING_MPSC    - writers do not take the device lock; only for the
+ *                       capacities of the specialized rings, see ReadMe
+ * SQUEUE_RING_SPSC    - as SQUEUE_RING_MPSC for a single writer at a time;
+ *                       a second open for writing fails with EBUSY, and the
+ *                       writing file must not be written by two threads at once
+ * SQUEUE_RING_FAIR    - give every senderID its own sub-queue and serve them
+ *                       by weighted deficit round robin; the sub-queues
+ *                       share the capacity, a sender holding at most as
+ *                       many tokens as are free; combines with
+ *                       SQUEUE_RING_DYNAMIC and SQUEUE_RING_SEQUENCE, not
+ *                       with SQUEUE_RING_MPSC/SPSC
+ * SQUEUE_RING_SEQUENCE - number the tokens on enqueue: msgID is set to the
+ *                       next number of the queue and flowSeq to the next
+ *                       number of its (senderID, receiverID) flow, both from
+ *                       1 and without gaps; not with SQUEUE_RING_MPSC/SPSC
+ */
+#define SQUEUE_RING_DYNAMIC	0x1
+#define SQUEUE_RING_MPSC	0x2
+#define SQUEUE_RING_SPSC	0x4
+#define SQUEUE_RING_FAIR	0x8
+#define SQUEUE_RING_SEQUENCE	0x10
+
+/**
+ * Number of flows a SQUEUE_RING_SEQUENCE queue keeps counters for. A token
+ * of a further flow is refused as if the queue were full.
+ */
+#define SQUEUE_SEQ_MAX_FLOWS	65536
+
+/**
+ * Limits of a SQUEUE_RING_FAIR queue. Senders count while they have tokens
+ * queued or a weight set; a token from a sender beyond
+ * SQUEUE_FAIR_MAX_SENDERS is refused as if the queue were full.
+ */
+#define SQUEUE_FAIR_MAX_SENDERS	256
+#define SQUEUE_FAIR_MAX_WEIGHT	1024
+
+/**
+ * Argument of SQUEUE_IOC_CREATE and SQUEUE_IOC_DELETE.
+ * capacity and flags are ignored on delete.
+ */
+typedef struct SqueueQueueReq_Tag
+{
+	char name[SQUEUE_NAME_LEN];
+	unsigned int capacity;
+	unsigned int flags;
+}SqueueQueueReq;
+
+#define SQUEUE_IOC_MAGIC 'q'
+
+/**
+ * Create the queue /dev/<name> holding up to capacity tokens.
+ * Fails with EEXIST if the name is taken, ENOSPC if no minor is left and
+ * EINVAL if no ring variant matches capacity and flags.
+ */
+#define SQUEUE_IOC_CREATE _IOW(SQUEUE_IOC_MAGIC, 1, SqueueQueueReq)
+
+/**
+ * Delete the queue /dev/<name>. Fails with EBUSY while the queue is open.
+ */
+#define SQUEUE_IOC_DELETE _IOW(SQUEUE_IOC_MAGIC, 2, SqueueQueueReq)
+
+/**
+ * Message Token Structure, the unit read from and written to a queue. msgID
+ * and flowSeq are assigned by the driver on queues created with
+ * SQUEUE_RING_SEQUENCE.
+ */
+typedef struct MessageToken_Tag
+{
+	int msgID;
+	int senderID;
+	int receiverID;
+	char str_msg[80];
+	unsigned long timeStamp1;
+	unsigned long timeStamp2;
+	unsigned int flowSeq;			//Sequence number within (senderID, receiverID)
+}MessageToken;
+
+/**
+ * Offsets of the MessageToken header fields seen by a reader filter.
+ * A filter may only load 32-bit words, "ld [k]", below SQUEUE_FILTER_LEN;
+ * "ld len" gives SQUEUE_FILTER_LEN.
+ */
+#define SQUEUE_FILTER_MSGID			0
+#define SQUEUE_FILTER_SENDERID		4
+#define SQUEUE_FILTER_RECEIVERID	8
+#define SQUEUE_FILTER_LEN			12
+
+/**
+ * Attach a classic BPF program to an open queue file, replacing any
+ * previous one. read() on the file runs the program against each token at
+ * the front of the queue; tokens for which it returns 0 are dropped from
+ * the queue without being copied to user space.
+ * Since the dropped tokens are gone for every reader, the file must be the
+ * only one open for reading the queue: the ioctl fails with EBUSY otherwise,
+ * and so does opening the queue for reading while the filter is attached.
+ */
+#define SQUEUE_IOC_SET_FILTER _IOW(SQUEUE_IOC_MAGIC, 3, struct sock_fprog)
+
+/**
+ * Detach the filter of an open queue file
+ */
+#define SQUEUE_IOC_CLEAR_FILTER _IO(SQUEUE_IOC_MAGIC, 4)
+
+/**
+ * Argument of SQUEUE_IOC_SET_WEIGHT
+ */
+typedef struct SqueueWeightReq_Tag
+{
+	int senderID;
+	unsigned int weight;        /* Tokens per round, 1 to SQUEUE_FAIR_MAX_WEIGHT */
+}SqueueWeightReq;
+
+/**
+ * Set the weight of a sender on an open SQUEUE_RING_FAIR queue. A sender
+ * with weight w is handed up to w tokens on each round; senders start with
+ * weight 1. Fails with EINVAL on any other queue.
+ */
+#define SQUEUE_IOC_SET_WEIGHT _IOW(SQUEUE_IOC_MAGIC, 5, SqueueWeightReq)
+
+/**
+ * Longest time to live of SQUEUE_IOC_SET_TTL, one day
+ */
+#define SQUEUE_MAX_TTL_NS	(86400ULL * 1000000000ULL)
+
+/**
+ * Set the time to live of the tokens of an open queue in nanoseconds, 0 to
+ * keep tokens until they are read, at most SQUEUE_MAX_TTL_NS (EINVAL).
+ * Readers silently skip tokens that have been queued for longer, and a
+ * writer finding a locked queue full reclaims them first. Applies to the
+ * queue, not only to the file.
+ */
+#define SQUEUE_IOC_SET_TTL _IOW(SQUEUE_IOC_MAGIC, 6, __u64)
+
+#endif /* SQUEUE_IOCTL_H */
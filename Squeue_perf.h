@@ -0,0 +1,161 @@
+/******************************************************************************
+ *
+ * File Name: Squeue_perf.h
+ *
+ * Description: Hardware and software performance counters of the threads of
+ * main_1.c, read through perf_event_open(). Every thread opens its own
+ * counters with perfThreadStart() and adds them to the totals of its role
+ * (sender, router, receiver) with perfThreadStop(). perfReport() prints the
+ * totals normalized per message as tab separated lines, which
+ * profile_diff.sh compares between two runs.
+ *
+ * Counters include the time spent in the driver. Reading them for kernel
+ * code needs root or kernel.perf_event_paranoid <= 1; a counter that can
+ * not be opened is reported as NA.
+ *
+ *****************************************************************************/
+
+#ifndef SQUEUE_PERF_H
+#define SQUEUE_PERF_H
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/**
+ * Counters collected for every thread
+ */
+#define PERF_COUNTERS(X)												\
+	X(cycles,           PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES)		\
+	X(instructions,     PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS)	\
+	X(cache_misses,     PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES)	\
+	X(context_switches, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES)	\
+	X(page_faults,      PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS)
+
+enum PerfCounter
+{
+#define X(name, type, config) PERF_##name,
+	PERF_COUNTERS(X)
+#undef X
+	PERF_NUM_COUNTERS
+};
+
+static const struct
+{
+	const char *name;
+	unsigned int type;
+	unsigned long long config;
+}perfCounters[PERF_NUM_COUNTERS] =
+{
+#define X(name, type, config) { #name, type, config },
+	PERF_COUNTERS(X)
+#undef X
+};
+
+/**
+ * Totals of the threads of one role
+ */
+typedef struct
+{
+	const char *name;
+	pthread_mutex_t lock;
+	int threads;
+	int missing[PERF_NUM_COUNTERS];			//Threads that could not count
+	unsigned long long total[PERF_NUM_COUNTERS];
+}PerfRole;
+
+#define PERF_ROLE_INIT(roleName) { roleName, PTHREAD_MUTEX_INITIALIZER, 0, { 0 }, { 0 } }
+
+/**
+ * Counters of the calling thread
+ */
+static __thread int perfFd[PERF_NUM_COUNTERS];
+
+/**
+ * Function to start counting for the calling thread.
+ */
+void perfThreadStart(void)
+{
+	struct perf_event_attr attr;
+	int i;
+	for(i=0;i<PERF_NUM_COUNTERS;i++)
+	{
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = perfCounters[i].type;
+		attr.config = perfCounters[i].config;
+		attr.exclude_hv = 1;
+		/* Counters are multiplexed if there are more than the pmu has */
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		perfFd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+}
+
+/**
+ * Function to stop counting for the calling thread and add its counts to
+ * the totals of role.
+ */
+void perfThreadStop(PerfRole *role)
+{
+	unsigned long long value[3];		//count, time enabled, time running
+	unsigned long long count[PERF_NUM_COUNTERS];
+	int valid[PERF_NUM_COUNTERS];
+	int i;
+	for(i=0;i<PERF_NUM_COUNTERS;i++)
+	{
+		valid[i] = 0;
+		if(perfFd[i] < 0)
+		{
+			continue;
+		}
+		if(read(perfFd[i], value, sizeof(value)) == sizeof(value) && value[2])
+		{
+			count[i] = value[2] < value[1] ? (unsigned long long)((double)value[0] * value[1] / value[2]) : value[0];
+			valid[i] = 1;
+		}
+		close(perfFd[i]);
+	}
+	pthread_mutex_lock(&role->lock);
+	role->threads++;
+	for(i=0;i<PERF_NUM_COUNTERS;i++)
+	{
+		if(valid[i])
+		{
+			role->total[i] += count[i];
+		}
+		else
+		{
+			role->missing[i]++;
+		}
+	}
+	pthread_mutex_unlock(&role->lock);
+}
+
+/**
+ * Function to print the totals of the roles normalized per message, one
+ * "role metric per_message total threads" line per counter of a role.
+ */
+void perfReport(FILE *fp, PerfRole *roles, int numRoles, unsigned long messages, const char *config)
+{
+	int r, i;
+	fprintf(fp, "# squeue profile %s messages=%lu\n", config, messages);
+	fprintf(fp, "# role\tmetric\tper_message\ttotal\tthreads\n");
+	for(r=0;r<numRoles;r++)
+	{
+		for(i=0;i<PERF_NUM_COUNTERS;i++)
+		{
+			if(roles[r].missing[i] || !roles[r].threads || !messages)
+			{
+				fprintf(fp, "%s\t%s\tNA\tNA\t%d\n", roles[r].name, perfCounters[i].name, roles[r].threads);
+				continue;
+			}
+			fprintf(fp, "%s\t%s\t%.3f\t%llu\t%d\n", roles[r].name, perfCounters[i].name,
+				(double)roles[r].total[i] / messages, roles[r].total[i], roles[r].threads);
+		}
+	}
+}
+
+#endif /* SQUEUE_PERF_H */
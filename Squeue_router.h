@@ -0,0 +1,341 @@
+/******************************************************************************
+ *
+ * File Name: Squeue_router.h
+ *
+ * Description: Parallel bus router used by main_1.c and Squeue_bench.c. A
+ * dispatcher thread reads bus_in_q in batches and hands every token to one
+ * of N worker threads, picked by receiverID % N, so all tokens of a receiver
+ * go through the same worker in the order they were read. Each worker keeps
+ * a bounded staging FIFO per receiver and writes the staged tokens to the
+ * output queue of the receiver, found in a receiverID -> queue table. A full
+ * output queue is retried on the next pass while the worker serves its other
+ * receivers, so one slow receiver does not hold up the others until its
+ * staging FIFO is full.
+ *
+ *****************************************************************************/
+
+#ifndef SQUEUE_ROUTER_H
+#define SQUEUE_ROUTER_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+#include "Squeue_ioctl.h"
+
+#define ROUTER_MAX_WORKERS 16
+#define ROUTER_INBOX_SIZE 256		//Tokens between dispatcher and a worker, power of two
+#define ROUTER_STAGING_SIZE 64		//Tokens staged per receiver, power of two
+#define ROUTER_BATCH 16				//Tokens read from bus_in_q per readv()
+#define ROUTER_IDLE_US 100			//Back off of a thread that found no work
+
+/**
+ * Tokens handed from the dispatcher to a worker. Single producer, single
+ * consumer; the indices run freely and are masked on access.
+ */
+typedef struct
+{
+	MessageToken tok[ROUTER_INBOX_SIZE];
+	atomic_uint head;				//Next token the worker takes
+	atomic_uint tail;				//Next slot the dispatcher fills
+}RouterInbox;
+
+/**
+ * Tokens of one receiver waiting for room in its output queue. Only touched
+ * by the worker that owns the receiver.
+ */
+typedef struct
+{
+	MessageToken tok[ROUTER_STAGING_SIZE];
+	unsigned int head;
+	unsigned int tail;
+}RouterStaging;
+
+struct Router_Tag;
+
+/**
+ * Optional callbacks run by each router thread when it starts and before it
+ * exits, e.g. to profile the router threads.
+ */
+typedef struct
+{
+	void (*threadStart)(void *arg);
+	void (*threadStop)(void *arg);
+	void *arg;
+}RouterHooks;
+
+typedef struct
+{
+	struct Router_Tag *router;
+	int workerId;
+	pthread_t thread;
+	RouterInbox inbox;
+	unsigned long routed;			//Tokens written to output queues
+	unsigned long writes;			//writev() calls
+	unsigned long full;				//writev() calls refused by a full queue
+}RouterWorker;
+
+typedef struct Router_Tag
+{
+	int fd_in;						//bus_in_q
+	const int *routeTable;			//Output queue fd by receiverID, -1 if none
+	int maxReceiverID;
+	int numWorkers;
+	RouterStaging *staging;			//By receiverID
+	RouterWorker *workers;
+	RouterHooks hooks;
+	pthread_t dispatcher;
+	atomic_int stop;				//No more tokens will be written to fd_in
+	atomic_int drained;				//Dispatcher saw fd_in empty after stop
+	unsigned long dispatched;		//Tokens read from fd_in
+	unsigned long dropped;			//Tokens for a receiver without a queue
+}Router;
+
+/**
+ * Function called by the dispatcher thread to move tokens from bus_in_q to
+ * the worker owning their receiver.
+ */
+void *routerDispatch(void *data)
+{
+	Router *router = (Router*)data;
+	MessageToken batch[ROUTER_BATCH];
+	struct iovec iov = { batch, sizeof(batch) };
+	RouterInbox *inbox;
+	ssize_t res;
+	unsigned int tail;
+	int i, n;
+	if(router->hooks.threadStart)
+	{
+		router->hooks.threadStart(router->hooks.arg);
+	}
+	while(1)
+	{
+		res = readv(router->fd_in, &iov, 1);
+		if(res <= 0)
+		{
+			/* Everything written before stop has been read once fd_in is empty */
+			if(atomic_load(&router->stop))
+			{
+				break;
+			}
+			usleep(ROUTER_IDLE_US);
+			continue;
+		}
+		n = res / sizeof(MessageToken);
+		for(i=0;i<n;i++)
+		{
+			if(batch[i].receiverID < 1 || batch[i].receiverID > router->maxReceiverID ||
+				router->routeTable[batch[i].receiverID] < 0)
+			{
+				router->dropped++;
+				continue;
+			}
+			inbox = &router->workers[batch[i].receiverID % router->numWorkers].inbox;
+			tail = atomic_load_explicit(&inbox->tail, memory_order_relaxed);
+			while(tail - atomic_load_explicit(&inbox->head, memory_order_acquire) == ROUTER_INBOX_SIZE)
+			{
+				sched_yield();
+			}
+			inbox->tok[tail & (ROUTER_INBOX_SIZE - 1)] = batch[i];
+			atomic_store_explicit(&inbox->tail, tail + 1, memory_order_release);
+			router->dispatched++;
+		}
+	}
+	atomic_store(&router->drained, 1);
+	if(router->hooks.threadStop)
+	{
+		router->hooks.threadStop(router->hooks.arg);
+	}
+	return NULL;
+}
+
+/**
+ * Function to write the staged tokens of a receiver to its output queue.
+ * Returns the number of tokens written.
+ */
+int routerFlush(RouterWorker *worker, int receiverID)
+{
+	Router *router = worker->router;
+	RouterStaging *st = &router->staging[receiverID];
+	struct iovec iov[2];
+	unsigned int pending = st->tail - st->head;
+	unsigned int first = st->head & (ROUTER_STAGING_SIZE - 1);
+	ssize_t res;
+	int iovcnt = 1;
+	if(!pending)
+	{
+		return 0;
+	}
+	/* The staged tokens wrap at most once */
+	iov[0].iov_base = &st->tok[first];
+	iov[0].iov_len = (first + pending <= ROUTER_STAGING_SIZE ? pending : ROUTER_STAGING_SIZE - first) * sizeof(MessageToken);
+	if(iov[0].iov_len < pending * sizeof(MessageToken))
+	{
+		iov[1].iov_base = &st->tok[0];
+		iov[1].iov_len = pending * sizeof(MessageToken) - iov[0].iov_len;
+		iovcnt = 2;
+	}
+	worker->writes++;
+	res = writev(router->routeTable[receiverID], iov, iovcnt);
+	if(res <= 0)
+	{
+		worker->full++;
+		return 0;
+	}
+	st->head += res / sizeof(MessageToken);
+	worker->routed += res / sizeof(MessageToken);
+	return res / sizeof(MessageToken);
+}
+
+/**
+ * Function called by the worker threads to stage the tokens of their inbox
+ * and write them to the output queues of their receivers.
+ */
+void *routerWork(void *data)
+{
+	RouterWorker *worker = (RouterWorker*)data;
+	Router *router = worker->router;
+	RouterInbox *inbox = &worker->inbox;
+	RouterStaging *st;
+	MessageToken *tok;
+	unsigned int head, tail;
+	int progress, pending, drained;
+	int r;
+	if(router->hooks.threadStart)
+	{
+		router->hooks.threadStart(router->hooks.arg);
+	}
+	while(1)
+	{
+		progress = 0;
+		/* drained is read first so that no token can arrive after the inbox is seen empty */
+		drained = atomic_load(&router->drained);
+
+		/* Stage the inbox, stopping at a token whose receiver has no room left */
+		head = atomic_load_explicit(&inbox->head, memory_order_relaxed);
+		tail = atomic_load_explicit(&inbox->tail, memory_order_acquire);
+		while(head != tail)
+		{
+			tok = &inbox->tok[head & (ROUTER_INBOX_SIZE - 1)];
+			st = &router->staging[tok->receiverID];
+			if(st->tail - st->head == ROUTER_STAGING_SIZE)
+			{
+				break;
+			}
+			st->tok[st->tail++ & (ROUTER_STAGING_SIZE - 1)] = *tok;
+			head++;
+			progress = 1;
+		}
+		atomic_store_explicit(&inbox->head, head, memory_order_release);
+
+		/* Write out every receiver of this worker that has tokens staged */
+		pending = 0;
+		for(r = worker->workerId ? worker->workerId : router->numWorkers; r <= router->maxReceiverID; r += router->numWorkers)
+		{
+			if(routerFlush(worker, r))
+			{
+				progress = 1;
+			}
+			pending |= router->staging[r].tail != router->staging[r].head;
+		}
+
+		if(!progress)
+		{
+			if(drained && head == tail && !pending)
+			{
+				break;
+			}
+			usleep(ROUTER_IDLE_US);
+		}
+	}
+	if(router->hooks.threadStop)
+	{
+		router->hooks.threadStop(router->hooks.arg);
+	}
+	return NULL;
+}
+
+/**
+ * Function to free a stopped router
+ */
+void routerFree(Router *router)
+{
+	free(router->staging);
+	free(router->workers);
+	router->staging = NULL;
+	router->workers = NULL;
+}
+
+/**
+ * Function to start a router with numWorkers workers reading fd_in and
+ * writing the token of receiver r to routeTable[r], 1 <= r <= maxReceiverID.
+ * hooks may be NULL. On failure nothing is left running or allocated.
+ */
+int routerStart(Router *router, int fd_in, const int *routeTable, int maxReceiverID, int numWorkers,
+	const RouterHooks *hooks)
+{
+	int i, j;
+	memset(router, 0, sizeof(Router));
+	if(numWorkers < 1 || numWorkers > ROUTER_MAX_WORKERS)
+	{
+		return -1;
+	}
+	router->fd_in = fd_in;
+	router->routeTable = routeTable;
+	router->maxReceiverID = maxReceiverID;
+	router->numWorkers = numWorkers;
+	if(hooks)
+	{
+		router->hooks = *hooks;
+	}
+	router->staging = calloc(maxReceiverID + 1, sizeof(RouterStaging));
+	router->workers = calloc(numWorkers, sizeof(RouterWorker));
+	if(!router->staging || !router->workers)
+	{
+		free(router->staging);
+		free(router->workers);
+		return -1;
+	}
+	for(i=0;i<numWorkers;i++)
+	{
+		router->workers[i].router = router;
+		router->workers[i].workerId = i;
+		if(pthread_create(&router->workers[i].thread, NULL, &routerWork, (void*)&router->workers[i]))
+		{
+			break;
+		}
+	}
+	if(i == numWorkers && !pthread_create(&router->dispatcher, NULL, &routerDispatch, (void*)router))
+	{
+		return 0;
+	}
+	/* No token was dispatched, the workers already started exit at once */
+	atomic_store(&router->stop, 1);
+	atomic_store(&router->drained, 1);
+	for(j=0;j<i;j++)
+	{
+		pthread_join(router->workers[j].thread, NULL);
+	}
+	routerFree(router);
+	return -1;
+}
+
+/**
+ * Function to stop a router once no more tokens are written to its input.
+ * Returns after every token already in the input has been routed.
+ */
+void routerStop(Router *router)
+{
+	int i;
+	atomic_store(&router->stop, 1);
+	pthread_join(router->dispatcher, NULL);
+	for(i=0;i<router->numWorkers;i++)
+	{
+		pthread_join(router->workers[i].thread, NULL);
+	}
+}
+
+#endif /* SQUEUE_ROUTER_H */
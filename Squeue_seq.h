@@ -0,0 +1,209 @@
+/******************************************************************************
+ *
+ * File Name: Squeue_seq.h
+ *
+ * Description: Receiver side delivery accounting for tokens numbered by a
+ * SQUEUE_RING_SEQUENCE queue such as bus_in_q. The driver gives the tokens
+ * of every (senderID, receiverID) flow the flowSeq numbers 1, 2, 3, ... so a
+ * receiver sees each of its flows as a gap free sequence unless tokens were
+ * lost, e.g. expired, or delivered out of order. The numbers last as long as
+ * the queue, so a flow is tracked from the first number the receiver gets;
+ * earlier numbers belong to an earlier run and are not expected.
+ *
+ * Each flow is tracked with a sliding window of the last SEQ_WINDOW numbers
+ * below the highest one seen, the way IPsec tracks replays. A number that
+ * arrives below the highest one is reordered, one seen twice a duplicate,
+ * and a number still missing when it slides out of the window is lost.
+ * The lost numbers of the next SEQ_WINDOW numbers below the window are
+ * remembered, so that a lost number turning up later is counted as late
+ * instead, and any other number there as a duplicate. A number older than
+ * that can not be told apart and is counted as stale, as is a number from
+ * before the first one received that arrives below the window.
+ *
+ * A tracker is used by a single receiver thread.
+ *
+ *****************************************************************************/
+
+#ifndef SQUEUE_SEQ_H
+#define SQUEUE_SEQ_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "Squeue_ioctl.h"
+
+#define SEQ_WINDOW 64				//Bits of SeqFlow.window
+#define SEQ_MAX_SENDERS 256			//Flows tracked per receiver, by senderID
+
+/**
+ * State of the flow from one sender. Bit i of window is set if number
+ * maxSeq - i has been received; numbers below firstSeq are not expected and
+ * never counted as lost. Bit i of lostMap is set if number
+ * maxSeq - SEQ_WINDOW - i was counted as lost.
+ */
+typedef struct
+{
+	unsigned int firstSeq;			//First number received, 0 before that
+	unsigned int maxSeq;
+	uint64_t window;
+	uint64_t lostMap;
+	unsigned long received;
+	unsigned long lost;
+	unsigned long reordered;
+	unsigned long duplicates;
+	unsigned long late;
+	unsigned long stale;
+}SeqFlow;
+
+/**
+ * Delivery accounting of one receiver
+ */
+typedef struct
+{
+	SeqFlow flow[SEQ_MAX_SENDERS + 1];	//By senderID
+	unsigned long untracked;			//Tokens of a senderID out of range
+}SeqTracker;
+
+/**
+ * Totals over flows
+ */
+typedef struct
+{
+	unsigned long received;
+	unsigned long lost;					//Including numbers still missing in the window
+	unsigned long reordered;
+	unsigned long duplicates;
+	unsigned long late;
+	unsigned long stale;				//Too old to tell late from duplicate
+	unsigned long untracked;
+}SeqTotals;
+
+/**
+ * Function to initialize a tracker.
+ */
+void seqInit(SeqTracker *tracker)
+{
+	memset(tracker, 0, sizeof(SeqTracker));
+}
+
+/**
+ * Function to shift a bitmap left, by 64 or more giving 0.
+ */
+static inline uint64_t seqShift(uint64_t bits, unsigned int shift)
+{
+	return shift < 64 ? bits << shift : 0;
+}
+
+/**
+ * Function to get the window of a flow with the numbers that are not
+ * expected, those below firstSeq, marked as received.
+ */
+static inline uint64_t seqWindow(const SeqFlow *flow)
+{
+	if(!flow->firstSeq)
+	{
+		return ~(uint64_t)0;
+	}
+	return flow->window | ~(seqShift(1, flow->maxSeq - flow->firstSeq + 1) - 1);
+}
+
+/**
+ * Function to account a received token.
+ */
+void seqReceive(SeqTracker *tracker, const MessageToken *tok)
+{
+	SeqFlow *flow;
+	unsigned int seq = tok->flowSeq;
+	unsigned int shift, offset;
+	uint64_t window;
+	if(tok->senderID < 0 || tok->senderID > SEQ_MAX_SENDERS || !seq)
+	{
+		tracker->untracked++;
+		return;
+	}
+	flow = &tracker->flow[tok->senderID];
+	flow->received++;
+	if(!flow->firstSeq)
+	{
+		flow->firstSeq = seq;
+		flow->maxSeq = seq;
+		flow->window = 1;
+		return;
+	}
+	if(seq > flow->maxSeq)
+	{
+		/* Slide the window; numbers falling out of it unseen are lost */
+		shift = seq - flow->maxSeq;
+		window = seqWindow(flow);
+		if(shift >= SEQ_WINDOW)
+		{
+			/* The whole window leaves, followed by the numbers skipped past it */
+			flow->lost += SEQ_WINDOW - __builtin_popcountll(window) + (shift - SEQ_WINDOW);
+			flow->lostMap = seqShift(flow->lostMap, shift) | seqShift(~window, shift - SEQ_WINDOW) |
+				(seqShift(1, shift - SEQ_WINDOW) - 1);
+			flow->window = 1;
+		}
+		else
+		{
+			flow->lost += shift - __builtin_popcountll(window >> (SEQ_WINDOW - shift));
+			flow->lostMap = (flow->lostMap << shift) | (~window >> (SEQ_WINDOW - shift));
+			flow->window = (flow->window << shift) | 1;
+		}
+		flow->maxSeq = seq;
+		return;
+	}
+	offset = flow->maxSeq - seq;
+	if(offset >= 2 * SEQ_WINDOW || (offset >= SEQ_WINDOW && seq < flow->firstSeq))
+	{
+		flow->stale++;
+		flow->received--;
+		return;
+	}
+	if(offset >= SEQ_WINDOW)
+	{
+		offset -= SEQ_WINDOW;
+		if(!(flow->lostMap & ((uint64_t)1 << offset)))
+		{
+			flow->duplicates++;
+			flow->received--;
+			return;
+		}
+		/* Counted as lost when it left the window */
+		flow->lostMap &= ~((uint64_t)1 << offset);
+		flow->late++;
+		flow->lost--;
+		flow->reordered++;
+		return;
+	}
+	if(flow->window & ((uint64_t)1 << offset))
+	{
+		flow->duplicates++;
+		flow->received--;
+		return;
+	}
+	flow->window |= (uint64_t)1 << offset;
+	flow->reordered++;
+}
+
+/**
+ * Function to add the counts of a tracker to totals. Numbers still missing
+ * in the window are counted as lost.
+ */
+void seqTotals(const SeqTracker *tracker, SeqTotals *totals)
+{
+	const SeqFlow *flow;
+	int i;
+	for(i=0;i<=SEQ_MAX_SENDERS;i++)
+	{
+		flow = &tracker->flow[i];
+		totals->received += flow->received;
+		totals->lost += flow->lost + SEQ_WINDOW - __builtin_popcountll(seqWindow(flow));
+		totals->reordered += flow->reordered;
+		totals->duplicates += flow->duplicates;
+		totals->late += flow->late;
+		totals->stale += flow->stale;
+	}
+	totals->untracked += tracker->untracked;
+}
+
+#endif /* SQUEUE_SEQ_H */
@@ -0,0 +1,122 @@
+/******************************************************************************
+ *
+ * File Name: Squeue_seq_test.c
+ *
+ * Description: Test of the delivery accounting of Squeue_seq.h. Feeds a
+ * tracker tokens in a fixed order, including duplicates and numbers that
+ * arrive after leaving the window, and flows that do not start at 1, and
+ * checks every counter.
+ * Usage: make test, or ./Squeue_seq_test.o
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "Squeue_seq.h"
+
+int failures = 0;
+
+/**
+ * Function to compare a counter with its expected value.
+ */
+void check(const char *what, unsigned long value, unsigned long expected)
+{
+	if(value != expected)
+	{
+		printf("FAIL %s: %lu, expected %lu\n", what, value, expected);
+		failures++;
+	}
+}
+
+/**
+ * Function to deliver the numbers seqs[0..n-1] of a sender to a tracker.
+ */
+void deliver(SeqTracker *tracker, int senderID, const unsigned int *seqs, int n)
+{
+	MessageToken tok;
+	int i;
+	memset(&tok, 0, sizeof(tok));
+	tok.senderID = senderID;
+	tok.receiverID = 1;
+	for(i=0;i<n;i++)
+	{
+		tok.flowSeq = seqs[i];
+		seqReceive(tracker, &tok);
+	}
+}
+
+int main(void)
+{
+	static SeqTracker tracker;
+	SeqTotals totals;
+	SeqFlow *flow;
+	unsigned int lateStart[101];
+	int i;
+
+	/* In order, a duplicate in the window and a reordered number */
+	const unsigned int inWindow[] = { 1, 2, 3, 3, 5, 4 };
+	/* 2..36 leave the window lost; 2 is late, then a duplicate, as is 1 */
+	const unsigned int outOfWindow[] = { 1, 100, 2, 2, 1, 40 };
+	/* 1 is older than the lost numbers remembered */
+	const unsigned int stale[] = { 1, 200, 1 };
+	/* Numbering left over from an earlier run; 1000 is reordered, not lost */
+	const unsigned int reorderFirst[] = { 1001, 1000, 1000 };
+
+	seqInit(&tracker);
+	deliver(&tracker, 1, inWindow, sizeof(inWindow) / sizeof(inWindow[0]));
+	deliver(&tracker, 2, outOfWindow, sizeof(outOfWindow) / sizeof(outOfWindow[0]));
+	deliver(&tracker, 3, stale, sizeof(stale) / sizeof(stale[0]));
+	deliver(&tracker, SEQ_MAX_SENDERS + 1, stale, 1);
+	/* 5001..5100 in order, then 5000 from before the first, below the window */
+	for(i=0;i<100;i++)
+	{
+		lateStart[i] = 5001 + i;
+	}
+	lateStart[100] = 5000;
+	deliver(&tracker, 4, lateStart, 101);
+	deliver(&tracker, 5, reorderFirst, sizeof(reorderFirst) / sizeof(reorderFirst[0]));
+
+	flow = &tracker.flow[1];
+	check("in window received", flow->received, 5);
+	check("in window duplicates", flow->duplicates, 1);
+	check("in window reordered", flow->reordered, 1);
+	check("in window lost", flow->lost, 0);
+
+	flow = &tracker.flow[2];
+	check("out of window received", flow->received, 4);
+	check("out of window lost", flow->lost, 34);
+	check("out of window late", flow->late, 1);
+	check("out of window duplicates", flow->duplicates, 2);
+	check("out of window reordered", flow->reordered, 2);
+
+	flow = &tracker.flow[3];
+	check("stale received", flow->received, 2);
+	check("stale stale", flow->stale, 1);
+	check("stale lost", flow->lost, 135);
+	check("stale late", flow->late, 0);
+
+	flow = &tracker.flow[4];
+	check("late start received", flow->received, 100);
+	check("late start lost", flow->lost, 0);
+	check("late start stale", flow->stale, 1);
+
+	flow = &tracker.flow[5];
+	check("reorder first received", flow->received, 2);
+	check("reorder first reordered", flow->reordered, 1);
+	check("reorder first duplicates", flow->duplicates, 1);
+
+	/* Numbers still missing in the windows count as lost */
+	memset(&totals, 0, sizeof(totals));
+	seqTotals(&tracker, &totals);
+	check("total received", totals.received, 113);
+	check("total lost", totals.lost, 34 + 62 + 198);
+	check("total reordered", totals.reordered, 4);
+	check("total duplicates", totals.duplicates, 4);
+	check("total late", totals.late, 1);
+	check("total stale", totals.stale, 2);
+	check("total untracked", totals.untracked, 1);
+
+	printf("Squeue_seq_test: %s\n", failures ? "FAILED" : "passed");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,98 @@
+/******************************************************************************
+ *
+ * File Name: Squeue_trace.h
+ *
+ * Description: Tracepoints of driver Squeue.c. They follow individual tokens
+ * through bus_in_q and bus_out_qN and can be recorded with perf or ftrace,
+ * e.g. "perf record -e 'squeue:*'". A disabled tracepoint is a patched-out
+ * branch and costs nothing on the enqueue/dequeue path.
+ *
+ * latency is the accumulated queueing time of the token in TSC cycles at the
+ * time of the event, the same value that is reported to user space through
+ * timeStamp1 and timeStamp2. For squeue_lock_contended it is the time spent
+ * waiting for the device lock in nanoseconds, for squeue_expired the age of
+ * the token in TSC cycles.
+ * 
+ *****************************************************************************/
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM squeue
+
+#if !defined(_SQUEUE_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _SQUEUE_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/*
+ * Squeue.c includes this header after struct My_dev and My_ring_count().
+ */
+
+/**
+ * Common layout of all queue events. tok is NULL when the event has no token,
+ * e.g. a read of an empty queue.
+ */
+DECLARE_EVENT_CLASS(squeue_token,
+
+	TP_PROTO(struct My_dev *my_devp, const MessageToken *tok, unsigned long long latency),
+
+	TP_ARGS(my_devp, tok, latency),
+
+	TP_STRUCT__entry(
+		__field(int, qid)
+		__field(int, msgID)
+		__field(int, senderID)
+		__field(int, receiverID)
+		__field(unsigned int, occupancy)
+		__field(unsigned long long, latency)
+	),
+
+	TP_fast_assign(
+		__entry->qid = my_devp->minor;
+		__entry->msgID = tok ? tok->msgID : 0;
+		__entry->senderID = tok ? tok->senderID : 0;
+		__entry->receiverID = tok ? tok->receiverID : 0;
+		__entry->occupancy = My_ring_count(my_devp);
+		__entry->latency = latency;
+	),
+
+	TP_printk("qid=%d msgID=%d senderID=%d receiverID=%d occupancy=%u latency=%llu",
+		__entry->qid, __entry->msgID, __entry->senderID, __entry->receiverID,
+		__entry->occupancy, __entry->latency)
+);
+
+DEFINE_EVENT(squeue_token, squeue_enqueue,
+	TP_PROTO(struct My_dev *my_devp, const MessageToken *tok, unsigned long long latency),
+	TP_ARGS(my_devp, tok, latency));
+
+DEFINE_EVENT(squeue_token, squeue_dequeue,
+	TP_PROTO(struct My_dev *my_devp, const MessageToken *tok, unsigned long long latency),
+	TP_ARGS(my_devp, tok, latency));
+
+DEFINE_EVENT(squeue_token, squeue_full,
+	TP_PROTO(struct My_dev *my_devp, const MessageToken *tok, unsigned long long latency),
+	TP_ARGS(my_devp, tok, latency));
+
+DEFINE_EVENT(squeue_token, squeue_empty,
+	TP_PROTO(struct My_dev *my_devp, const MessageToken *tok, unsigned long long latency),
+	TP_ARGS(my_devp, tok, latency));
+
+DEFINE_EVENT(squeue_token, squeue_filtered,
+	TP_PROTO(struct My_dev *my_devp, const MessageToken *tok, unsigned long long latency),
+	TP_ARGS(my_devp, tok, latency));
+
+DEFINE_EVENT(squeue_token, squeue_expired,
+	TP_PROTO(struct My_dev *my_devp, const MessageToken *tok, unsigned long long latency),
+	TP_ARGS(my_devp, tok, latency));
+
+DEFINE_EVENT(squeue_token, squeue_lock_contended,
+	TP_PROTO(struct My_dev *my_devp, const MessageToken *tok, unsigned long long latency),
+	TP_ARGS(my_devp, tok, latency));
+
+#endif /* _SQUEUE_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE Squeue_trace
+#include <trace/define_trace.h>
@@ -7,7 +7,7 @@
  * Date: 21-SEP-2014
  *
  * Description: A test program that initiates multiple threads to access the 
- * shared queues consisting of 3 senders, 1 bus daemon and 3 receivers.
+ * shared queues consisting of 3 senders, a bus router and 3 receivers.
  * 
  *****************************************************************************/
  
@@ -20,9 +20,20 @@
 #include <fcntl.h>
 #include <time.h>
 #include <unistd.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <sys/ioctl.h>
+#include "Squeue_ioctl.h"
+#include "Squeue_perf.h"
+#include "Squeue_router.h"
+#include "Squeue_seq.h"
 
 #define NUMBER_OF_SENDERS 3
-#define NUMBER_OF_RECEIVERS 3
+#define NUMBER_OF_RECEIVERS 3		//Default, can be given as first argument
+#define NUMBER_OF_ROUTERS 3			//Router workers, can be given as second argument
+#define MAX_RECEIVERS 1000
+#define DEFAULT_RECEIVER_QUEUES 3	//bus_out_q1..3 are created by the driver
+#define QUEUE_CAPACITY 10			//Capacity of the receiver queues created here
 #define CPU_CLOCK_SPEED 400000000 //400 MHz
 
 /**
@@ -35,36 +46,33 @@
  */ 
 unsigned int STR_MAX_LEN=80;
 unsigned int STR_MIN_LEN=10;
-unsigned int GLOBAL_SEQUENCE_NUM = 1;
-unsigned int GLOBAL_BUS_IN_Q_COUNTER = 0;
-unsigned int GLOBAL_BUS_OUT_Q_COUNTER = 0;
-unsigned int GLOBAL_BUS_OUT_Q1_COUNTER = 0;
-unsigned int GLOBAL_BUS_OUT_Q2_COUNTER = 0;
-unsigned int GLOBAL_BUS_OUT_Q3_COUNTER = 0;
-unsigned int GLOBAL_SENDER_FLAG = 0;
+atomic_uint GLOBAL_BUS_IN_Q_COUNTER = 0;
+atomic_uint GLOBAL_BUS_OUT_QN_COUNTER[MAX_RECEIVERS];
+atomic_uint GLOBAL_SENDER_FLAG = 0;
+atomic_uint GLOBAL_ROUTER_FLAG = 0;		//Every token the router will deliver is in bus_out_qN
+unsigned int NUMBER_OF_RECEIVER_QUEUES = NUMBER_OF_RECEIVERS;
 
 /**
- * mutex for protecting GLOBAL_SEQUENCE_NUM
- */ 
-pthread_mutex_t mutex;
+ * Performance counters of each thread role, collected when a profile file
+ * is given as third argument
+ */
+enum { ROLE_SENDER, ROLE_ROUTER, ROLE_RECEIVER, NUMBER_OF_ROLES };
+PerfRole PERF_ROLES[NUMBER_OF_ROLES] =
+{
+	PERF_ROLE_INIT("sender"),
+	PERF_ROLE_INIT("router"),
+	PERF_ROLE_INIT("receiver"),
+};
+int PROFILE = 0;
 
 /**
  * Function Declaration
  */
 char *getRandomString(unsigned int str_min_length, unsigned int str_max_length);
-
-/**
- * Message Token
- */
-typedef struct MessageToken_Tag
-{
-	int msgID;
-	int senderID;
-	int receiverID;
-	char str_msg[80];
-	unsigned long timeStamp1;
-	unsigned long timeStamp2;
-}MessageToken;
+unsigned int getReceivedCount(void);
+int openQueue(int fd_ctl, const char *name, int *created);
+void routerPerfStart(void *role);
+void routerPerfStop(void *role);
 
 /**
  * Thread Arguments
@@ -72,10 +80,10 @@ typedef struct MessageToken_Tag
 typedef struct 
 {
 	int threadId;
+	int receiverIndex;		//Receiver threads only, index into fd_bus_out_q
 	int fd_bus_in_q;
-	int fd_bus_out_q1;
-	int fd_bus_out_q2;
-	int fd_bus_out_q3;
+	int *fd_bus_out_q;		//Indexed by receiverID - 1
+	SeqTracker *tracker;	//Delivery accounting of a receiver
 }ThreadParams;
  
 /**
@@ -91,16 +99,16 @@ void *thread_transmit(void *data)
 	time_t endTime = time(0) + 10;
 	ThreadParams *tparams = (ThreadParams*)data;
 	MessageToken tok;
+	if(PROFILE)
+	{
+		perfThreadStart();
+	}
 	while(time(0) < endTime)
 	{
-		/*Begininning of mutex to lock GLOBAL_SEQUENCE_NUM*/
-		pthread_mutex_lock(&mutex);
-		tok.msgID = GLOBAL_SEQUENCE_NUM++;
-		pthread_mutex_unlock (&mutex);
-		/*End of mutex to lock GLOBAL_SEQUENCE_NUM*/
+		/*msgID and flowSeq are assigned by bus_in_q*/
 		
 		/*Sender thread generating a random receiver for the message*/
-		random_receiver = rand() % NUMBER_OF_RECEIVERS;
+		random_receiver = rand() % NUMBER_OF_RECEIVER_QUEUES;
 		strcpy(random_str, getRandomString(STR_MIN_LEN, STR_MAX_LEN));
 		tok.senderID = (tparams->threadId % 100 ) + 1;
 		tok.receiverID = random_receiver + 1;
@@ -125,102 +133,14 @@ void *thread_transmit(void *data)
 		}
 		else
 		{
-			/*Begininning of mutex to lock GLOBAL_BUS_IN_Q_COUNTER*/
-			pthread_mutex_lock(&mutex);
 			GLOBAL_BUS_IN_Q_COUNTER++;
-			pthread_mutex_unlock(&mutex);
-			/*End of mutex to lock GLOBAL_BUS_IN_Q_COUNTER*/
 		}
 	}
 	//printf("main_1.c ThreadID: %d thread_transmit() Ends\n",tparams->threadId);
-	pthread_exit(0);
-}
-
-/**
- * Function called by bus daemon thread to receive and send data.
- */
-void *thread_transmit_receive(void *data)
-{
-	int res;
-	ThreadParams *tparams = (ThreadParams*)data;
-	MessageToken tok;
-	//printf("main_1.c ThreadID: %d thread_transmit_receive() Start\n",tparams->threadId);
-	while(1)
+	if(PROFILE)
 	{
-		usleep((rand() % 10 ) * 1000);
-		res = read(tparams->fd_bus_in_q, &tok, sizeof(MessageToken));
-
-		//IF failed while reading
-		if(res == -1)
-		{
-			usleep((rand() % 10 ) * 1000);
-		}
-		else
-		{
-			if(tok.receiverID == 1)
-			{
-				res = write(tparams->fd_bus_out_q1, &tok, sizeof(MessageToken));
-				if(res == -1)
-				{
-					while(res == -1)
-					{
-						usleep((rand() % 10 ) * 1000);
-						res = write(tparams->fd_bus_out_q1, &tok, sizeof(MessageToken));
-					}
-				}
-				else if(res == sizeof(MessageToken))
-				{
-					printf("Can not write to the bus_out_q device file.\n");
-					close(tparams->fd_bus_in_q);
-					exit(-1);
-				}
-			}
-			else if(tok.receiverID == 2)
-			{
-				res = write(tparams->fd_bus_out_q2, &tok, sizeof(MessageToken));
-				if(res == -1)
-				{
-					while(res == -1)
-					{
-						usleep((rand() % 10 ) * 1000);
-						res = write(tparams->fd_bus_out_q2, &tok, sizeof(MessageToken));
-					}
-				}
-				else if(res == sizeof(MessageToken))
-				{
-					printf("Can not write to the bus_out_q device file.\n");
-					close(tparams->fd_bus_in_q);
-					exit(-1);
-				}
-			}
-			else if(tok.receiverID == 3)
-			{
-				res = write(tparams->fd_bus_out_q3, &tok, sizeof(MessageToken));
-				if(res == -1)
-				{
-					while(res == -1)
-					{
-						usleep((rand() % 10 ) * 1000);
-						res = write(tparams->fd_bus_out_q3, &tok, sizeof(MessageToken));
-					}
-				}
-				else if(res == sizeof(MessageToken))
-				{
-					printf("Can not write to the bus_out_q device file.\n");
-					close(tparams->fd_bus_in_q);
-					exit(-1);
-				}
-			}
-		}
-		pthread_mutex_lock(&mutex);
-		GLOBAL_BUS_OUT_Q_COUNTER++;
-		pthread_mutex_unlock(&mutex);
-		if((GLOBAL_BUS_IN_Q_COUNTER == GLOBAL_BUS_OUT_Q_COUNTER) && (GLOBAL_SENDER_FLAG==1))
-		{
-			break;
-		}
+		perfThreadStop(&PERF_ROLES[ROLE_SENDER]);
 	}
-	//printf("main_1.c ThreadID: %d thread_transmit_receive() Ends\n",tparams->threadId);
 	pthread_exit(0);
 }
 
@@ -235,50 +155,33 @@ void *thread_receive(void *data)
 	int stopFlag=0;
 	int res,ret;
 	int sleep_interval;
-	int threadid;
+	int threadid = tparams->receiverIndex;
+	int routerDone;
+	if(PROFILE)
+	{
+		perfThreadStart();
+	}
 	while(stopFlag != 1)
 	{
 		usleep((rand() % 10 ) * 1000);
-		threadid = (tparams->threadId) % 300;
-		if(threadid == 0)
-		{
-			res = read(tparams->fd_bus_out_q1, &tok,  sizeof(MessageToken));
-			if(res != -1)
-			{
-				GLOBAL_BUS_OUT_Q1_COUNTER++;
-#ifdef STATIC
-#else
-				printf("%d          %d          %d          %ld         %lu mS    %s\n",tok.msgID,tok.senderID,tok.receiverID,tok.timeStamp1 + tok.timeStamp2, (tok.timeStamp1 + tok.timeStamp2) * 1000 / CPU_CLOCK_SPEED, tok.str_msg);
-#endif
-			}
-		}
-		else if(threadid == 1)
-		{
-			res = read(tparams->fd_bus_out_q2, &tok,  sizeof(MessageToken));
-			if(res != -1)
-			{
-				GLOBAL_BUS_OUT_Q2_COUNTER++;
-#ifdef STATIC
-#else
-				printf("%d          %d          %d          %ld         %lu mS     %s\n",tok.msgID,tok.senderID,tok.receiverID,tok.timeStamp1 + tok.timeStamp2,(tok.timeStamp1 + tok.timeStamp2) * 1000 / CPU_CLOCK_SPEED, tok.str_msg);
-#endif
-			}
-		}
-		else if(threadid == 2)
+		/*
+		 * The flag is read before the queue, so an empty queue after the router
+		 * stopped is final; dropped or expired tokens never arrive
+		 */
+		routerDone = GLOBAL_ROUTER_FLAG;
+		res = read(tparams->fd_bus_out_q[threadid], &tok,  sizeof(MessageToken));
+		if(res != -1)
 		{
-			res = read(tparams->fd_bus_out_q3, &tok,  sizeof(MessageToken));
-			if(res != -1)
-			{
-				GLOBAL_BUS_OUT_Q3_COUNTER++;
+			GLOBAL_BUS_OUT_QN_COUNTER[threadid]++;
+			seqReceive(tparams->tracker, &tok);
 #ifdef STATIC
 #else
-				printf("%d          %d          %d          %ld         %lu mS     %s\n",tok.msgID,tok.senderID,tok.receiverID,tok.timeStamp1 + tok.timeStamp2,(tok.timeStamp1 + tok.timeStamp2) * 1000 / CPU_CLOCK_SPEED , tok.str_msg);
+			printf("%d          %d          %d          %ld         %lu mS    %s\n",tok.msgID,tok.senderID,tok.receiverID,tok.timeStamp1 + tok.timeStamp2, (tok.timeStamp1 + tok.timeStamp2) * 1000 / CPU_CLOCK_SPEED, tok.str_msg);
 #endif
-			}
 		}
 		if(res == -1)
 		{
-			if(((GLOBAL_BUS_OUT_Q1_COUNTER + GLOBAL_BUS_OUT_Q2_COUNTER + GLOBAL_BUS_OUT_Q3_COUNTER) == GLOBAL_BUS_IN_Q_COUNTER) && (GLOBAL_SENDER_FLAG==1))
+			if(routerDone)
 			{
 				
 				stopFlag = 1;
@@ -290,6 +193,10 @@ void *thread_receive(void *data)
 		}
 	}
 	//printf("main_1.c ThreadID: %d thread_receive() Ends\n",tparams->threadId);
+	if(PROFILE)
+	{
+		perfThreadStop(&PERF_ROLES[ROLE_RECEIVER]);
+	}
 	pthread_exit(0);
 }
 
@@ -298,52 +205,93 @@ void *thread_receive(void *data)
  */
 int main(int argc, char **argv)
 {
-	int fd_bus_in_q, fd_bus_out_q1, fd_bus_out_q2, fd_bus_out_q3;
-	pthread_t thread_id_s[NUMBER_OF_SENDERS], thread_id_bd, thread_id_r[NUMBER_OF_RECEIVERS];
-	ThreadParams *tp_s[NUMBER_OF_SENDERS],*tp_bd, *tp_r[NUMBER_OF_RECEIVERS];
+	int fd_ctl, fd_bus_in_q, fd_bus_out_q[MAX_RECEIVERS];
+	int created_q[MAX_RECEIVERS];
+	char name[SQUEUE_NAME_LEN];
+	SqueueQueueReq req;
+	pthread_t thread_id_s[NUMBER_OF_SENDERS], thread_id_r[MAX_RECEIVERS];
+	ThreadParams *tp_s[NUMBER_OF_SENDERS], *tp_r[MAX_RECEIVERS];
+	int routeTable[MAX_RECEIVERS + 1];
+	int numRouters = NUMBER_OF_ROUTERS;
+	Router router;
+	RouterHooks routerHooks;
+	SeqTotals seq;
+	const char *profileFile = NULL;
+	char config[64];
+	FILE *fp;
+	struct timespec ts_start, ts_end;
+	unsigned long long router_ns;
+	unsigned long routed, full;
 	
-	/*Open Device bus_in_q*/
-	fd_bus_in_q = open("/dev/bus_in_q", O_RDWR);
-	if (fd_bus_in_q < 0)
+	/*Number of receivers, one bus_out_q per receiver*/
+	if(argc > 1)
 	{
-		printf("Can not open device file bus_in_q.\n");
+		NUMBER_OF_RECEIVER_QUEUES = atoi(argv[1]);
+		if(NUMBER_OF_RECEIVER_QUEUES < 1 || NUMBER_OF_RECEIVER_QUEUES > MAX_RECEIVERS)
+		{
+			printf("Number of receivers must be between 1 and %d.\n", MAX_RECEIVERS);
+			return 0;
+		}
+	}
+	/*Number of router workers*/
+	if(argc > 2)
+	{
+		numRouters = atoi(argv[2]);
+		if(numRouters < 1 || numRouters > ROUTER_MAX_WORKERS)
+		{
+			printf("Number of router workers must be between 1 and %d.\n", ROUTER_MAX_WORKERS);
+			return 0;
+		}
+	}
+	/*Profile file, "-" for the console*/
+	if(argc > 3)
+	{
+		profileFile = argv[3];
+		PROFILE = 1;
+	}
+
+	/*Open the control node, used to create queues beyond bus_out_q3*/
+	fd_ctl = open("/dev/" SQUEUE_CTL_NAME, O_RDWR);
+	if (fd_ctl < 0)
+	{
+		printf("Can not open device file %s.\n", SQUEUE_CTL_NAME);
 		return 0;
 	}
-	/*Open Device bus_out_q1*/
-	fd_bus_out_q1 = open("/dev/bus_out_q1", O_RDWR);
-	if (fd_bus_out_q1 < 0)
+
+	/*Open Device bus_in_q*/
+	fd_bus_in_q = open("/dev/bus_in_q", O_RDWR);
+	if (fd_bus_in_q < 0)
 	{
 		printf("Can not open device file bus_in_q.\n");
 		return 0;
 	}
-	/*Open Device bus_out_q2*/
-	fd_bus_out_q2 = open("/dev/bus_out_q2", O_RDWR);
-	if (fd_bus_out_q2 < 0)
+	/*Open Devices bus_out_q1..N*/
+	int i,ret;
+	for(i=0;i<NUMBER_OF_RECEIVER_QUEUES;i++)
 	{
-		printf("Can not open device file bus_out_q2.\n");
-		return 0;
+		sprintf(name, "bus_out_q%d", i+1);
+		fd_bus_out_q[i] = openQueue(fd_ctl, name, &created_q[i]);
+		if (fd_bus_out_q[i] < 0)
+		{
+			printf("Can not open device file %s.\n", name);
+			return 0;
+		}
 	}
-	/*Open Device bus_out_q3*/
-	fd_bus_out_q3 = open("/dev/bus_out_q3", O_RDWR);
-	if (fd_bus_out_q3 < 0)
+
+	/*Receiver -> queue map of the router, receiver r reads bus_out_q<r>*/
+	routeTable[0] = -1;
+	for(i=0;i<NUMBER_OF_RECEIVER_QUEUES;i++)
 	{
-		printf("Can not open device file bus_out_q3.\n");
-		return 0;
+		routeTable[i+1] = fd_bus_out_q[i];
 	}
 	
-	/* Mutex Initialization*/
-	pthread_mutex_init(&mutex, NULL);
-	
-	int i,ret;
 	/* Sender Threads Creation*/
 	for(i=0;i<NUMBER_OF_SENDERS;i++)
 	{
 		tp_s[i] = malloc(sizeof(ThreadParams));
 		tp_s[i] -> threadId = 100+i;
 		tp_s[i] -> fd_bus_in_q = fd_bus_in_q;
-		tp_s[i] -> fd_bus_out_q1 = fd_bus_out_q1;
-		tp_s[i] -> fd_bus_out_q2 = fd_bus_out_q2;
-		tp_s[i] -> fd_bus_out_q3 = fd_bus_out_q3;
+		tp_s[i] -> fd_bus_out_q = fd_bus_out_q;
 		ret = pthread_create(&thread_id_s[i], NULL, &thread_transmit, (void*)tp_s[i]);
 		if(ret)
 		{
@@ -353,20 +301,17 @@ int main(int argc, char **argv)
 	}
 	//printf("Sender Threads Created\n");
 	
-	/* Bus Daemon Thread Creation*/
-	tp_bd = malloc(sizeof(ThreadParams));
-	tp_bd ->  threadId = 200;
-	tp_bd -> fd_bus_in_q = fd_bus_in_q;
-	tp_bd -> fd_bus_out_q1 = fd_bus_out_q1;
-	tp_bd -> fd_bus_out_q2 = fd_bus_out_q2;
-	tp_bd -> fd_bus_out_q3 = fd_bus_out_q3;
-	ret = pthread_create(&thread_id_bd, NULL, &thread_transmit_receive, (void*)tp_bd);
-	if(ret)
+	/* Bus Router Creation*/
+	clock_gettime(CLOCK_MONOTONIC, &ts_start);
+	routerHooks.threadStart = routerPerfStart;
+	routerHooks.threadStop = routerPerfStop;
+	routerHooks.arg = &PERF_ROLES[ROLE_ROUTER];
+	if(routerStart(&router, fd_bus_in_q, routeTable, NUMBER_OF_RECEIVER_QUEUES, numRouters, PROFILE ? &routerHooks : NULL))
 	{
-		printf("ERROR; return code from pthread_create() is %d\n", ret);
+		printf("ERROR; can not start the bus router\n");
 		exit(-1);
 	}
-	//printf("Bus Daemon Thread Created\n");
+	//printf("Bus Router Created\n");
 #ifdef STATIC
 #else
 	printf("MessageID  SenderID  ReceiverID  TSCCounter      Time(mS)        Message\n");
@@ -374,14 +319,15 @@ int main(int argc, char **argv)
 #endif
 	
 	/* Receiver Threads Creation*/
-	for(i=0;i<NUMBER_OF_RECEIVERS;i++)
+	for(i=0;i<NUMBER_OF_RECEIVER_QUEUES;i++)
 	{
 		tp_r[i] = malloc(sizeof(ThreadParams));
 		tp_r[i] -> threadId = 300+i;
+		tp_r[i] -> receiverIndex = i;
 		tp_r[i] -> fd_bus_in_q = fd_bus_in_q;
-		tp_r[i] -> fd_bus_out_q1 = fd_bus_out_q1;
-		tp_r[i] -> fd_bus_out_q2 = fd_bus_out_q2;
-		tp_r[i] -> fd_bus_out_q3 = fd_bus_out_q3;
+		tp_r[i] -> fd_bus_out_q = fd_bus_out_q;
+		tp_r[i] -> tracker = malloc(sizeof(SeqTracker));
+		seqInit(tp_r[i] -> tracker);
 		ret = pthread_create(&thread_id_r[i], NULL, &thread_receive, (void*)tp_r[i]);
 		if(ret)
 		{
@@ -397,29 +343,140 @@ int main(int argc, char **argv)
 		pthread_join(thread_id_s[i], NULL);
 	}
 	GLOBAL_SENDER_FLAG = 1;
-	pthread_join(thread_id_bd, NULL);
-	for(i=0;i<NUMBER_OF_RECEIVERS;i++)
+	routerStop(&router);
+	GLOBAL_ROUTER_FLAG = 1;
+	clock_gettime(CLOCK_MONOTONIC, &ts_end);
+	router_ns = (ts_end.tv_sec - ts_start.tv_sec) * 1000000000ULL + ts_end.tv_nsec - ts_start.tv_nsec;
+	routed = 0;
+	full = 0;
+	for(i=0;i<numRouters;i++)
+	{
+		routed += router.workers[i].routed;
+		full += router.workers[i].full;
+	}
+	memset(&seq, 0, sizeof(seq));
+	for(i=0;i<NUMBER_OF_RECEIVER_QUEUES;i++)
 	{
 		pthread_join(thread_id_r[i], NULL);
+		seqTotals(tp_r[i] -> tracker, &seq);
+		free(tp_r[i] -> tracker);
 	}
 #ifdef STATIC
 #else
-	printf("Number of Messages Sent: %d\n",GLOBAL_BUS_IN_Q_COUNTER);
-	printf("Number of Messages Received By Receiver 1: %d\n",GLOBAL_BUS_OUT_Q1_COUNTER);
-	printf("Number of Messages Received By Receiver 2: %d\n",GLOBAL_BUS_OUT_Q2_COUNTER);
-	printf("Number of Messages Received By Receiver 3: %d\n",GLOBAL_BUS_OUT_Q3_COUNTER);
-	printf("Total Number of Messages Received: %d\n",GLOBAL_BUS_OUT_Q1_COUNTER + GLOBAL_BUS_OUT_Q2_COUNTER + GLOBAL_BUS_OUT_Q3_COUNTER);
+	printf("Number of Messages Sent: %u\n",atomic_load(&GLOBAL_BUS_IN_Q_COUNTER));
+	for(i=0;i<NUMBER_OF_RECEIVER_QUEUES;i++)
+	{
+		printf("Number of Messages Received By Receiver %d: %u\n",i+1,atomic_load(&GLOBAL_BUS_OUT_QN_COUNTER[i]));
+	}
+	printf("Total Number of Messages Received: %u\n",getReceivedCount());
+	printf("Messages lost: %lu, reordered: %lu (late: %lu), duplicated: %lu, without sequence number: %lu, too old to classify: %lu\n",
+		seq.lost, seq.reordered, seq.late, seq.duplicates, seq.untracked, seq.stale);
+	printf("Router: %d workers routed %lu messages in %llu mS (%.0f messages/S), %lu writes to a full queue, %lu dropped\n",
+		numRouters, routed, router_ns / 1000000, routed * 1e9 / router_ns, full, router.dropped);
 #endif
+	routerFree(&router);
+
+	/*Counters per message of each thread role*/
+	if(PROFILE)
+	{
+		fp = strcmp(profileFile, "-") ? fopen(profileFile, "w") : stdout;
+		if(!fp)
+		{
+			printf("Can not open profile file %s.\n", profileFile);
+		}
+		else
+		{
+			sprintf(config, "receivers=%d routers=%d", NUMBER_OF_RECEIVER_QUEUES, numRouters);
+			perfReport(fp, PERF_ROLES, NUMBER_OF_ROLES, GLOBAL_BUS_IN_Q_COUNTER, config);
+			if(fp != stdout)
+			{
+				fclose(fp);
+			}
+		}
+	}
 	
-	/*Close the file descriptors*/
+	/*Close the file descriptors and delete the queues created here*/
 	close(fd_bus_in_q);
-	close(fd_bus_out_q1);
-	close(fd_bus_out_q2);
-	close(fd_bus_out_q3);
+	for(i=0;i<NUMBER_OF_RECEIVER_QUEUES;i++)
+	{
+		close(fd_bus_out_q[i]);
+		if(created_q[i])
+		{
+			memset(&req, 0, sizeof(req));
+			sprintf(req.name, "bus_out_q%d", i+1);
+			ioctl(fd_ctl, SQUEUE_IOC_DELETE, &req);
+		}
+	}
+	close(fd_ctl);
 	
 	return 0;
 }
 
+/**
+ * Functions run by the router threads to count their role.
+ */
+void routerPerfStart(void *role)
+{
+	perfThreadStart();
+}
+
+void routerPerfStop(void *role)
+{
+	perfThreadStop((PerfRole*)role);
+}
+
+/**
+ * Function to get the total number of messages received by all receivers.
+ */
+unsigned int getReceivedCount(void)
+{
+	unsigned int total = 0;
+	int i;
+	for(i=0;i<NUMBER_OF_RECEIVER_QUEUES;i++)
+	{
+		total += GLOBAL_BUS_OUT_QN_COUNTER[i];
+	}
+	return total;
+}
+
+/**
+ * Function to open the queue /dev/<name>, creating it through the control
+ * node if it does not exist. created is set if the queue was created here.
+ */
+int openQueue(int fd_ctl, const char *name, int *created)
+{
+	SqueueQueueReq req;
+	char path[SQUEUE_NAME_LEN + 8];
+	int fd;
+	int retries;
+	sprintf(path, "/dev/%s", name);
+	*created = 0;
+	fd = open(path, O_RDWR);
+	if(fd >= 0 || errno != ENOENT)
+	{
+		return fd;
+	}
+	memset(&req, 0, sizeof(req));
+	snprintf(req.name, sizeof(req.name), "%s", name);
+	req.capacity = QUEUE_CAPACITY;
+	if(ioctl(fd_ctl, SQUEUE_IOC_CREATE, &req) < 0)
+	{
+		return -1;
+	}
+	*created = 1;
+	/* udev creates the device node asynchronously */
+	for(retries = 0; retries < 100; retries++)
+	{
+		fd = open(path, O_RDWR);
+		if(fd >= 0 || errno != ENOENT)
+		{
+			break;
+		}
+		usleep(10000);
+	}
+	return fd;
+}
+
 /**
  * Function to generate a Random String given the maximum and minimum size of 
  * random string to be generated.
@@ -0,0 +1,75 @@
+#!/bin/sh
+###############################################################################
+#
+# File Name: profile_diff.sh
+#
+# Description: Compares two profiles written by "./main_1.o <receivers>
+# <routers> <profile file>". For every role and metric it prints the value
+# per message of both runs and the change in percent, and flags a metric
+# that grew by more than the threshold (default 5%) as a regression.
+# Every metric counts a cost, so only growth is flagged. Metrics only in
+# the old profile are listed as removed.
+# Exits with 1 if there is a regression, so it can gate a driver change.
+# Usage: ./profile_diff.sh <old profile> <new profile> [threshold %]
+#
+###############################################################################
+
+if [ $# -lt 2 ]; then
+	echo "Usage: $0 <old profile> <new profile> [threshold %]" >&2
+	exit 2
+fi
+THRESHOLD=${3:-5}
+
+awk -F '\t' -v threshold="$THRESHOLD" '
+	/^#/ { if (FNR == 1) config[FILENAME == ARGV[1] ? "old" : "new"] = $0; next }
+	FILENAME == ARGV[1] {
+		key = $1 "\t" $2
+		oldKeys[++m] = key
+		old[key] = $3
+		next
+	}
+	{
+		key = $1 "\t" $2
+		keys[++n] = key
+		new[key] = $3
+	}
+	END {
+		if (config["old"] != "" && config["new"] != "") {
+			sub(/^# squeue profile /, "", config["old"])
+			sub(/^# squeue profile /, "", config["new"])
+			printf("old: %s\nnew: %s\n", config["old"], config["new"])
+		}
+		printf("%-9s %-17s %14s %14s %9s\n", "role", "metric", "old/msg", "new/msg", "change")
+		status = 0
+		for (i = 1; i <= n; i++) {
+			key = keys[i]
+			split(key, part, "\t")
+			if (!(key in old) || old[key] == "NA" || new[key] == "NA") {
+				printf("%-9s %-17s %14s %14s %9s\n", part[1], part[2],
+					(key in old) ? old[key] : "-", new[key], "NA")
+				continue
+			}
+			if (old[key] == 0) {
+				change = (new[key] == 0) ? 0 : 100
+			} else {
+				change = (new[key] - old[key]) * 100 / old[key]
+			}
+			flag = ""
+			if (change > threshold) {
+				flag = "  REGRESSION"
+				status = 1
+			}
+			printf("%-9s %-17s %14.3f %14.3f %8.1f%%%s\n", part[1], part[2],
+				old[key], new[key], change, flag)
+		}
+		for (i = 1; i <= m; i++) {
+			key = oldKeys[i]
+			if (key in new) {
+				continue
+			}
+			split(key, part, "\t")
+			printf("%-9s %-17s %14s %14s %9s\n", part[1], part[2], old[key], "-", "removed")
+		}
+		exit status
+	}
+' "$1" "$2"